@@ -2,8 +2,12 @@
 #include <imagehlp.h>
 #include <tlhelp32.h>
 #include <vcl.h>
+#include <map>
+#include <list>
 #pragma hdrstop
 #include "callstack.h"
+#include "modtable.h"
+#include "stackdump.h"
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 
@@ -39,6 +43,7 @@ typedef DWORD (__stdcall *SYMGETOPTIONSPROC)( VOID );
 typedef BOOL (__stdcall *SYMGETSYMFROMADDRPROC)(IN HANDLE hProcess, IN DWORD dwAddr,	OUT PDWORD pdwDisplacement, OUT PIMAGEHLP_SYMBOL Symbol );
 typedef BOOL (__stdcall *SYMINITIALIZEPROC)( IN HANDLE hProcess, IN PSTR UserSearchPath, IN BOOL fInvadeProcess );
 typedef DWORD (__stdcall *SYMLOADMODULEPROC)(IN HANDLE hProcess, IN HANDLE hFile,IN PSTR ImageName, IN PSTR ModuleName, IN DWORD BaseOfDll, IN DWORD SizeOfDll );
+typedef BOOL (__stdcall *SYMUNLOADMODULEPROC)(IN HANDLE hProcess, IN DWORD BaseOfDll );
 typedef DWORD (__stdcall *SYMSETOPTIONSPROC)(IN DWORD SymOptions);
 typedef BOOL (__stdcall *STACKWALKPROC)(DWORD MachineType, HANDLE hProcess,HANDLE hThread, LPSTACKFRAME StackFrame, PVOID ContextRecord,	PREAD_PROCESS_MEMORY_ROUTINE ReadMemoryRoutine,	PFUNCTION_TABLE_ACCESS_ROUTINE FunctionTableAccessRoutine,	PGET_MODULE_BASE_ROUTINE GetModuleBaseRoutine,	PTRANSLATE_ADDRESS_ROUTINE TranslateAddress );
 typedef DWORD (__stdcall WINAPI *UNDECORATESYMBOLNAMEPROC)(PCSTR DecoratedName, PSTR UnDecoratedName,DWORD UndecoratedLength, DWORD Flags );
@@ -47,12 +52,16 @@ typedef BOOL (__stdcall *SYMENUMERATESYMBOLSPROC)(IN HANDLE hProcess, IN DWORD b
 typedef HANDLE (__stdcall *CREATETOOLHELP32SNAPSHOTPROC)( DWORD dwFlags, DWORD th32ProcessID );
 typedef BOOL (__stdcall *MODULE32FIRSTPROC)( HANDLE hSnapshot, LPMODULEENTRY32 lpme );
 typedef BOOL (__stdcall *MODULE32NEXTPROC)( HANDLE hSnapshot, LPMODULEENTRY32 lpme );
+typedef BOOL (__stdcall *THREAD32FIRSTPROC)( HANDLE hSnapshot, LPTHREADENTRY32 lpte );
+typedef BOOL (__stdcall *THREAD32NEXTPROC)( HANDLE hSnapshot, LPTHREADENTRY32 lpte );
 //
 typedef struct _MODULEINFO {LPVOID lpBaseOfDll; DWORD SizeOfImage; LPVOID EntryPoint;} MODULEINFO, *LPMODULEINFO;
 typedef BOOL (__stdcall *ENUMPROCESSMODULESPROC)( HANDLE hProcess, HMODULE *lphModule, DWORD cb, LPDWORD lpcbNeeded );
 typedef DWORD (__stdcall *GETMODULEFILENAMEEXPROC)( HANDLE hProcess, HMODULE hModule, LPSTR lpFilename, DWORD nSize );
 typedef DWORD (__stdcall *GETMODULEBASENAMEPROC)( HANDLE hProcess, HMODULE hModule, LPSTR lpFilename, DWORD nSize );
 typedef BOOL (__stdcall *GETMODULEINFORMATIONPROC)( HANDLE hProcess, HMODULE hModule, LPMODULEINFO pmi, DWORD nSize );
+//
+typedef WORD (__stdcall *RTLCAPTURESTACKBACKTRACEPROC)( DWORD FramesToSkip, DWORD FramesToCapture, PVOID *BackTrace, PDWORD BackTraceHash );
 
 
 SYMCLEANUPPROC             pSymCleanup = NULL;
@@ -64,6 +73,7 @@ SYMGETOPTIONSPROC          pSymGetOptions = NULL;
 SYMGETSYMFROMADDRPROC      pSymGetSymFromAddr = NULL;
 SYMINITIALIZEPROC          pSymInitialize = NULL;
 SYMLOADMODULEPROC          pSymLoadModule = NULL;
+SYMUNLOADMODULEPROC        pSymUnloadModule = NULL;
 SYMSETOPTIONSPROC          pSymSetOptions = NULL;
 STACKWALKPROC              pStackWalk = NULL;
 UNDECORATESYMBOLNAMEPROC   pUnDecorateSymbolName = NULL;
@@ -73,6 +83,8 @@ HINSTANCE hImagehlpDll=NULL;
 CREATETOOLHELP32SNAPSHOTPROC pCreateToolhelp32Snapshot = NULL;
 MODULE32FIRSTPROC pModule32First = NULL;
 MODULE32NEXTPROC pModule32Next = NULL;
+THREAD32FIRSTPROC pThread32First = NULL; // only needed for ShowCallstack's all-threads dump
+THREAD32NEXTPROC pThread32Next = NULL;
 HINSTANCE hToolHelp = NULL;
 //
 ENUMPROCESSMODULESPROC pEnumProcessModules = NULL;
@@ -81,11 +93,19 @@ GETMODULEBASENAMEPROC pGetModuleBaseName = NULL;
 GETMODULEINFORMATIONPROC pGetModuleInformation = NULL;
 HINSTANCE hPsapi = NULL;
 //
+RTLCAPTURESTACKBACKTRACEPROC pRtlCaptureStackBackTrace = NULL; // in kernel32 from XP on
+//
 bool isinited=false;// have we tried at least once to init?
 bool issucc=false;  // was it succesfull?
 bool usemods=false; // will we also be able to enumerate modules?
 bool usesyms=false; // will we also be able to use symbols?
-int modcount=0; // the last time we loaded symbols, how many modules was it for?
+volatile bool isready=false; // has dinit finished? (capture checks it without the lock)
+//
+// imagehlp isn't thread-safe, so every call into it is made with symlock held
+// (and joblock guards the resolver thread's queue)
+CRITICAL_SECTION symlock, joblock;
+class TLocksInit {public: TLocksInit() {InitializeCriticalSection(&symlock); InitializeCriticalSection(&joblock);} ~TLocksInit() {DeleteCriticalSection(&joblock); DeleteCriticalSection(&symlock);} } LocksInit;
+class TSymLock {public: TSymLock() {EnterCriticalSection(&symlock);} ~TSymLock() {LeaveCriticalSection(&symlock);} };
 
 
 
@@ -120,75 +140,101 @@ void __fastcall dble(AnsiString s) {db(s+" "+le());}
 // FillModuleList -- gets a list of all modules (i.e. dlls, current exe, packages ...)
 //   There are two implementations. First, we try to get it using toolhelp.
 //   If that fails, then we try using PSAPI. We load both toolhelp and PSAPI
-//   dynamically.
-// EnsureModuleSymbolsLoaded - we use 'modcount' as a sort of checksum, recording
-//   how many modules' symbols have been loaded. Initially zero. Every time
-//   someone calls this function we check how many modules are currently loaded.
-//   If there are != modcount, then someone's been loading or unloading dlls,
-//   so we take the opportunity to FillModuleList and load symbols from every
-//   single one of them again. Obviously the checksum might break, if you
-//   unload one library and load another. Be careful!
+//   dynamically. Each module's timestamp is read from its PE header every
+//   time, so that a dll unloaded and a rebuilt one loaded at the same place,
+//   with the same size, can be told apart. That's two small ReadProcessMemory
+//   calls. The names take two string allocations, so a module whose base,
+//   size and timestamp 'loadedmods' already has is left without them, and
+//   Update gives it the known names.
+// EnsureModuleSymbolsLoaded - every time someone calls this function we list
+//   the modules that are loaded now, and hand them to 'loadedmods' (see
+//   modtable.cpp), which compares them with the last list. Only modules that
+//   have turned up since get their symbols loaded, and only ones that have
+//   gone get them unloaded, along with whatever was cached about them. So
+//   usually nothing at all needs doing. A module whose symbols fail to load
+//   is still counted as done, rather than being tried again on every call.
 //=============================================================================
 //
-typedef struct {AnsiString imageName; AnsiString moduleName; DWORD baseAddress; DWORD size;} TModuleEntry;
+TModuleTable loadedmods;
+std::vector<TModuleEntry> curmods; // kept between calls, for its storage
+void __fastcall ForgetModule(DWORD base);
 //
-void __fastcall FillModuleListTH32(TList *modules, DWORD pid )
+DWORD __fastcall ModuleTimeStamp(HANDLE hProcess, DWORD base)
+{ IMAGE_DOS_HEADER dos; struct {DWORD sig; IMAGE_FILE_HEADER fh;} nt; SIZE_T got;
+  if (!ReadProcessMemory(hProcess,(LPCVOID)base,&dos,sizeof(dos),&got) || dos.e_magic!=IMAGE_DOS_SIGNATURE) return 0;
+  if (!ReadProcessMemory(hProcess,(LPCVOID)(base+dos.e_lfanew),&nt,sizeof(nt),&got) || nt.sig!=IMAGE_NT_SIGNATURE) return 0;
+  return nt.fh.TimeDateStamp;
+}
+
+void __fastcall FillModuleListTH32(std::vector<TModuleEntry> &modules, DWORD pid, HANDLE hProcess )
 { HANDLE hSnap=pCreateToolhelp32Snapshot(TH32CS_SNAPMODULE,pid);
   if (hSnap==(HANDLE)-1) return;
   MODULEENTRY32 me; ZeroMemory(&me,sizeof(me)); me.dwSize=sizeof(me);
   bool keepgoing = !!pModule32First(hSnap,&me);
   while (keepgoing)
-  { TModuleEntry *e=new TModuleEntry;
-    e->imageName=me.szExePath;
-    e->moduleName=me.szModule;
-    e->baseAddress=(DWORD)me.modBaseAddr;
-    e->size=me.modBaseSize;
-    db("snapshot modbase=0x"+IntToHex((int)e->baseAddress,8)+" modbasesize=0x"+IntToHex((int)e->size,8)+" module="+e->moduleName+" exepath="+e->imageName);
-    modules->Add(e);
+  { modules.push_back(TModuleEntry()); TModuleEntry &e=modules.back();
+    e.baseAddress=(DWORD)me.modBaseAddr;
+    e.size=me.modBaseSize;
+    e.timeStamp=ModuleTimeStamp(hProcess,e.baseAddress);
+    if (loadedmods.Find(e.baseAddress,e.size,e.timeStamp)==NULL)
+    { e.imageName=me.szExePath;
+      e.moduleName=me.szModule;
+    }
     keepgoing = !!pModule32Next(hSnap,&me);
   }
   CloseHandle(hSnap);
 }
 
-void __fastcall FillModuleListPSAPI(TList *modules, DWORD pid, HANDLE hProcess )
-{ HMODULE hMods[MAX_PATH];
+void __fastcall FillModuleListPSAPI(std::vector<TModuleEntry> &modules, DWORD pid, HANDLE hProcess )
+{ std::vector<HMODULE> hMods(256);
   BOOL bres; DWORD size;
-  bres=pEnumProcessModules(hProcess,hMods,MAX_PATH,&size); if (!bres) return;
-  if (size>MAX_PATH) {db("EnumProcessModules failed: not enough space.");return;}
+  for (;;)
+  { DWORD cb=hMods.size()*sizeof(HMODULE);
+    bres=pEnumProcessModules(hProcess,&hMods[0],cb,&size); if (!bres) return;
+    if (size<=cb) break;
+    hMods.resize(size/sizeof(HMODULE)+16); // more were loaded than there was room for
+  }
   int nummods = size/sizeof(HMODULE);
   for (int i=0; i<nummods; i++)
-  { MODULEINFO mi; TModuleEntry *e=new TModuleEntry;
-    pGetModuleInformation(hProcess,hMods[i],&mi,sizeof(mi));
-    e->baseAddress=(DWORD)mi.lpBaseOfDll;
-    e->size=mi.SizeOfImage;
+  { MODULEINFO mi;
+    if (!pGetModuleInformation(hProcess,hMods[i],&mi,sizeof(mi))) continue; // unloaded in the meantime
+    modules.push_back(TModuleEntry()); TModuleEntry &e=modules.back();
+    e.baseAddress=(DWORD)mi.lpBaseOfDll;
+    e.size=mi.SizeOfImage;
+    e.timeStamp=ModuleTimeStamp(hProcess,e.baseAddress);
+    if (loadedmods.Find(e.baseAddress,e.size,e.timeStamp)!=NULL) continue;
     char buf[MAX_PATH]; buf[0]='\0'; pGetModuleFileNameEx(hProcess,hMods[i],buf,MAX_PATH);
-    e->imageName=buf;
+    e.imageName=buf;
     buf[0]='\0'; pGetModuleBaseName(hProcess,hMods[i],buf,MAX_PATH);
-    e->moduleName=buf;
-    db("snapshot modbase=0x"+IntToHex((int)e->baseAddress,8)+" modbasesize=0x"+IntToHex((int)e->size,8)+" module="+e->moduleName+" exepath="+e->imageName);
-    modules->Add(e);
+    e.moduleName=buf;
   }
 }
 
 void __fastcall EnsureModuleSymbolsLoaded()
-{ if (!usemods) return;
+{ if (!usemods || !usesyms) return;
   HANDLE hProcess=GetCurrentProcess(); DWORD pid=GetCurrentProcessId();
-  TList *modules=new TList();
-  if (hToolHelp!=NULL) FillModuleListTH32(modules,pid);
-  else if (hPsapi!=NULL) FillModuleListPSAPI(modules,pid,hProcess);
-  // only reload symbols if our naive checksum has indicated a change
-  if (modules->Count!=modcount)
-  { for (int i=0; i<modules->Count; i++)
-    { TModuleEntry *mod=(TModuleEntry*)modules->Items[i];
-      DWORD time=GetTickCount();
-      BOOL bres=pSymLoadModule(hProcess,0,mod->imageName.c_str(),mod->moduleName.c_str(),mod->baseAddress,mod->size);
-      int dt=(int)(GetTickCount()-time);
-      if (bres) db("Symbols loaded: "+mod->moduleName+" ["+dt+"ms]");
-      else dble("Failed to load symbols for "+mod->moduleName+" ["+dt+"ms]");
-      delete mod;
-    }
+  curmods.clear();
+  if (hToolHelp!=NULL) FillModuleListTH32(curmods,pid,hProcess);
+  else if (hPsapi!=NULL) FillModuleListPSAPI(curmods,pid,hProcess);
+  if (curmods.size()==0) return; // the listing failed; better to keep what we have
+  std::vector<TModuleEntry> added, removed;
+  loadedmods.Update(curmods,&added,&removed);
+  for (size_t i=0; i<removed.size(); i++)
+  { const TModuleEntry &mod=removed[i];
+    if (pSymUnloadModule!=NULL) pSymUnloadModule(hProcess,mod.baseAddress);
+    ForgetModule(mod.baseAddress);
+    db("Symbols unloaded: "+AnsiString(mod.moduleName.c_str()));
+  }
+  for (size_t i=0; i<added.size(); i++)
+  { const TModuleEntry &mod=added[i];
+    db("snapshot modbase=0x"+IntToHex((int)mod.baseAddress,8)+" modbasesize=0x"+IntToHex((int)mod.size,8)+" module="+mod.moduleName.c_str()+" exepath="+mod.imageName.c_str());
+    DWORD time=GetTickCount();
+    BOOL bres=pSymLoadModule(hProcess,0,(PSTR)mod.imageName.c_str(),(PSTR)mod.moduleName.c_str(),mod.baseAddress,mod.size);
+    int dt=(int)(GetTickCount()-time);
+    if (bres) db("Symbols loaded: "+AnsiString(mod.moduleName.c_str())+" ["+dt+"ms]");
+    else dble("Failed to load symbols for "+AnsiString(mod.moduleName.c_str())+" ["+dt+"ms]");
+    ForgetModule(mod.baseAddress);
   }
-  delete modules;
 }
 
 
@@ -202,6 +248,8 @@ void __fastcall EnsureModuleSymbolsLoaded()
 // dinit - This function gets called automatically the first time you try
 //   to get the callstack. It loads the imagehlp library dynamically,
 //   sets up the symbol manager, loads in symbols for all running processes.
+//   It's reached through densureinit, which makes sure that only one thread
+//   does it.
 // dexit - this function gets called automatically. It cleanups the
 //   symbol manager and unloads the dll
 //=============================================================================
@@ -209,6 +257,7 @@ void __fastcall EnsureModuleSymbolsLoaded()
 void __fastcall dinit()
 { if (isinited) return; isinited=true; issucc=false; usemods=false; usesyms=false;
   db("Initing...");
+  pRtlCaptureStackBackTrace = (RTLCAPTURESTACKBACKTRACEPROC) GetProcAddress( GetModuleHandle("kernel32.dll"), "RtlCaptureStackBackTrace" );
   hImagehlpDll=LoadLibrary("imagehlp.dll"); if (hImagehlpDll==NULL) {db("Failed to load library.");return;}
   pSymCleanup = (SYMCLEANUPPROC) GetProcAddress( hImagehlpDll, "SymCleanup" );
   pSymFunctionTableAccess = (SYMFUNCTIONTABLEACCESSPROC) GetProcAddress( hImagehlpDll, "SymFunctionTableAccess" );
@@ -222,6 +271,7 @@ void __fastcall dinit()
   pStackWalk = (STACKWALKPROC) GetProcAddress( hImagehlpDll, "StackWalk" );
   pUnDecorateSymbolName = (UNDECORATESYMBOLNAMEPROC) GetProcAddress( hImagehlpDll, "UnDecorateSymbolName" );
   pSymLoadModule = (SYMLOADMODULEPROC) GetProcAddress( hImagehlpDll, "SymLoadModule" );
+  pSymUnloadModule = (SYMUNLOADMODULEPROC) GetProcAddress( hImagehlpDll, "SymUnloadModule" );
   pSymEnumerateSymbols = (SYMENUMERATESYMBOLSPROC) GetProcAddress( hImagehlpDll, "SymEnumerateSymbols");
   bool ok=true;
   if (pSymCleanup==NULL) ok=false;
@@ -249,6 +299,8 @@ void __fastcall dinit()
     pCreateToolhelp32Snapshot = (CREATETOOLHELP32SNAPSHOTPROC)GetProcAddress(hToolHelp,"CreateToolhelp32Snapshot");
     pModule32First = (MODULE32FIRSTPROC)GetProcAddress(hToolHelp,"Module32First");
     pModule32Next = (MODULE32NEXTPROC)GetProcAddress(hToolHelp,"Module32Next");
+    pThread32First = (THREAD32FIRSTPROC)GetProcAddress(hToolHelp,"Thread32First");
+    pThread32Next = (THREAD32NEXTPROC)GetProcAddress(hToolHelp,"Thread32Next");
     if (pCreateToolhelp32Snapshot!=0 && pModule32First!=0 && pModule32Next!=0) break;
     FreeLibrary(hToolHelp); hToolHelp=NULL;
   }
@@ -300,11 +352,21 @@ void __fastcall dinit()
   issucc=true;
 }
 
+void __fastcall StopResolver();
+void __fastcall densureinit()
+{ if (isready) return;
+  TSymLock lock;
+  dinit(); isready=true;
+}
+
 void __fastcall dexit()
 { if (!isinited) return;
   db("Terminating...");
+  StopResolver();
+  TSymLock lock; isready=false;
   if (hImagehlpDll!=NULL)
   { pSymCleanup(GetCurrentProcess());
+    loadedmods.Clear(); dclearcache();
     if (hToolHelp!=NULL) FreeLibrary(hToolHelp); hToolHelp=NULL;
     if (hPsapi!=NULL) FreeLibrary(hPsapi); hPsapi=NULL;
     FreeLibrary(hImagehlpDll); hImagehlpDll=NULL;
@@ -317,6 +379,9 @@ class TDummyDExit {public: ~TDummyDExit() {dexit();} } DummyDExit;
 
 
 
+
+
+
 // The following is defined for x86 (XP and higher), x64 and IA64:
 #define GET_CURRENT_CONTEXT(c, contextFlags) \
   do { \
@@ -327,115 +392,519 @@ class TDummyDExit {public: ~TDummyDExit() {dexit();} } DummyDExit;
 
 
 //=============================================================================
-// dcallstack - the only useful function in this entire module! first, if
-//   it hasn't been done already, it ensures that dinit has been called.
-//   Retrieves the current context. Then uses StackWalk(...) to retrieve
-//   the stack frame by frame.
+// dcapture - records the current thread's stack into the caller's
+//   TCallCapture: just the PC of each frame, and the base of the module it's
+//   in. No symbols are looked up and no strings are built, so it's cheap
+//   enough to do on every exception. 'skip' drops that many frames off the
+//   top, besides dcapture's own. It uses RtlCaptureStackBackTrace, which
+//   follows the frame chain without imagehlp; on a system that hasn't got
+//   it, it falls back to StackWalk.
+// dcapturethread - the same for another thread, from a context that the
+//   caller got for it (e.g. with GetThreadContext, the thread suspended).
+//   That always takes StackWalk.
+// A frame's module base comes from VirtualQuery, and a frame in the same
+//   region as the one before it doesn't even need that. Keeping the base
+//   lets dresolve tell when a module has been unloaded since.
 //=============================================================================
-const int maxframes=0; // unbounded number of frames
 //
-AnsiString __fastcall dcallstack()
-{ dinit(); if (!issucc) return "<failed to init debugging>";
-  HANDLE hProcess=GetCurrentProcess(),
-  hThread=GetCurrentThread();
-
-  CONTEXT ctx;
-  BOOL bres;
-
-  if (hThread == GetCurrentThread())
-  {
-	//use this one, otherwise fails on WinXp!
-	GET_CURRENT_CONTEXT(ctx, CONTEXT_ALL);
-  }
-  else
-  {
-	ZeroMemory(&ctx,sizeof(ctx));
-	ctx.ContextFlags=CONTEXT_ALL;
-	bres = GetThreadContext(hThread,&ctx);
-	if (!bres) return "<failed to get context>";
-  };
-
-  EnsureModuleSymbolsLoaded();
+typedef struct {DWORD lo, hi, base;} TRegionCache;
+
+DWORD __fastcall ModuleBaseOf(DWORD pc, TRegionCache &rc)
+{ if (pc>=rc.lo && pc<rc.hi) return rc.base;
+  MEMORY_BASIC_INFORMATION mbi;
+  if (VirtualQuery((LPCVOID)pc,&mbi,sizeof(mbi))==0) return 0;
+  rc.lo=(DWORD)mbi.BaseAddress; rc.hi=rc.lo+mbi.RegionSize;
+  rc.base = (mbi.Type==MEM_IMAGE) ? (DWORD)mbi.AllocationBase : 0;
+  return rc.base;
+}
 
-  AnsiString callstack="";
-  //
-  STACKFRAME s; ZeroMemory(&s,sizeof(s));
+// WalkContext - StackWalk, frame by frame. The caller must hold symlock,
+//   since StackWalk calls back into imagehlp for the function tables.
+int __fastcall WalkContext(HANDLE hThread, CONTEXT &ctx, TCallFrame *frames, int maxframes, int skip)
+{ STACKFRAME s; ZeroMemory(&s,sizeof(s));
   s.AddrPC.Offset    = ctx.Eip;
   s.AddrPC.Mode      = AddrModeFlat;
   s.AddrFrame.Offset = ctx.Ebp;
   s.AddrFrame.Mode   = AddrModeFlat;
-  //also this must be filled?
   s.AddrStack.Offset = ctx.Esp;
   s.AddrStack.Mode   = AddrModeFlat;
+  TRegionCache rc={0,0,0};
+  int n=0;
+  for (int nframe=0; n<maxframes; nframe++)
+  { BOOL bres=pStackWalk(IMAGE_FILE_MACHINE_I386,GetCurrentProcess(),hThread,&s,&ctx,NULL,pSymFunctionTableAccess,pSymGetModuleBase,NULL);
+    if (!bres) break;
+    if (nframe>=skip)
+    { frames[n].pc=s.AddrPC.Offset;
+      frames[n].modbase=ModuleBaseOf(s.AddrPC.Offset,rc);
+      n++;
+    }
+    if (s.AddrReturn.Offset==0) break;
+  }
+  return n;
+}
 
-  IMAGEHLP_SYMBOL *pSym = (IMAGEHLP_SYMBOL *)malloc(sizeof(IMAGEHLP_SYMBOL) + MAX_PATH );
-  ZeroMemory(pSym,sizeof(IMAGEHLP_SYMBOL)+MAX_PATH); pSym->SizeOfStruct=sizeof(IMAGEHLP_SYMBOL); pSym->MaxNameLength=MAX_PATH;
-  IMAGEHLP_LINE Line; ZeroMemory(&Line,sizeof(Line)); Line.SizeOfStruct=sizeof(Line);
-  IMAGEHLP_MODULE Module; ZeroMemory(&Module,sizeof(Module)); Module.SizeOfStruct=sizeof(Module);
-  //
-  for (int nframe=0; maxframes<=0 || nframe<maxframes; nframe++)
-  { AnsiString desc="";
-	bres=pStackWalk(IMAGE_FILE_MACHINE_I386,hProcess,hThread,&s,&ctx,NULL,pSymFunctionTableAccess,pSymGetModuleBase,NULL);
-	if (!bres) break;
-	db(AnsiString(nframe)+": "+AnsiString(s.Far?"F":" ")+AnsiString(s.Virtual?"V":" ")+" pc=0x"+IntToHex((int)s.AddrPC.Offset,8)+" ret=0x"+IntToHex((int)s.AddrReturn.Offset,8)+" frame=0x"+IntToHex((int)s.AddrFrame.Offset,8)+" stack=0x"+IntToHex((int)s.AddrStack.Offset,8));
-    if (s.AddrPC.Offset!=0) desc=desc+IntToHex((int)s.AddrPC.Offset,8)+" ";
-	else db("<nosymbols for PC=0>");
-    if (s.AddrPC.Offset!=0 && usesyms)
-    { // First, the symbol
-      ZeroMemory(pSym,sizeof(IMAGEHLP_SYMBOL)+MAX_PATH); pSym->SizeOfStruct=sizeof(IMAGEHLP_SYMBOL); pSym->MaxNameLength=MAX_PATH;
-      AnsiString cursym="";
-      DWORD offsetFromSymbol=0;
-      bres=pSymGetSymFromAddr(hProcess, s.AddrPC.Offset,&offsetFromSymbol,pSym);
-      if (!bres)
-      { if (GetLastError()!=487) dble("SymGetSymFromAddr: failed.");
-      }
-      else
-	  { char undName[MAX_PATH], undFullName[MAX_PATH];
-        pUnDecorateSymbolName(pSym->Name,undName,MAX_PATH,UNDNAME_NAME_ONLY);
-        pUnDecorateSymbolName(pSym->Name,undFullName,MAX_PATH,UNDNAME_COMPLETE);
-        db(undName + (offsetFromSymbol==0? (AnsiString("")):(" + "+IntToHex((int)offsetFromSymbol,4))));
-        db("sig="+AnsiString(pSym->Name)+" decl="+undFullName);
-        desc=desc+AnsiString(undFullName); cursym=AnsiString(undFullName);
-        if (offsetFromSymbol!=0) desc=desc+"+0x"+IntToHex((int)offsetFromSymbol,8);
-      }
-      // Third, the line number.
-      if (pSymGetLineFromAddr!=NULL) // only present in NT5
-      { bres=pSymGetLineFromAddr(hProcess,s.AddrPC.Offset,&offsetFromSymbol,&Line);
-        if (!bres) {if (GetLastError()!=487) dble("SymGetLineFromAddr failed.");}
-		else
-        { db("line="+AnsiString(Line.FileName)+"("+Line.LineNumber+") + "+offsetFromSymbol);
-          desc=desc+" ("+AnsiString(Line.FileName)+" "+Line.LineNumber+")";
-        }
-      }
-      // Fourth, the module info
-      bres=SymGetModuleInfo(hProcess,s.AddrPC.Offset,&Module);
-      if (!bres) dble("SymGetModuleInfo failed.");
-      else
-      { AnsiString type;
-        switch (Module.SymType)
-        { case SymNone: type="-nosymbols-"; break;
-          case SymCoff: type="COFF"; break;
-          case SymCv: type="CV"; break;
-          case SymPdb: type="PDB"; break;
-          case SymExport: type="-exported-"; break;
-          case SymDeferred: type="-deferred-"; break;
-		  case SymSym: type="SYM"; break;
-          default: type="type="+AnsiString(Module.SymType);
-        }
-        db("Mod: "+AnsiString(Module.ModuleName)+"["+Module.ImageName+"] base="+IntToHex((int)Module.BaseOfImage,8));
-        db("Sym: "+type+" file="+Module.LoadedImageName);
-        desc=desc+" ["+AnsiString(Module.ModuleName)+"]";
-      }
-    } // end if (usesyms)
-	//if (nframe!=0)
-	callstack=callstack+desc+"\r\n";
-	// we don't print the first one, since it was just inside GetContextThread
-    if (s.AddrReturn.Offset==0) {SetLastError(0); break;}
+bool __fastcall dcapture(TCallCapture *cap, int skip)
+{ cap->count=0;
+  densureinit(); if (!issucc) return false;
+  if (pRtlCaptureStackBackTrace!=NULL)
+  { // On XP, FramesToSkip+FramesToCapture has to be less than 63
+    int maxframes=MaxCallFrames-1-skip; if (maxframes<=0) return true;
+    PVOID pcs[MaxCallFrames];
+    int n=pRtlCaptureStackBackTrace(1+skip,maxframes,pcs,NULL);
+    TRegionCache rc={0,0,0};
+    for (int i=0; i<n; i++)
+    { cap->frames[i].pc=(DWORD)pcs[i];
+      cap->frames[i].modbase=ModuleBaseOf((DWORD)pcs[i],rc);
+    }
+    cap->count=n;
+    return true;
   }
+  if (hImagehlpDll==NULL) return false;
+  CONTEXT ctx;
+  GET_CURRENT_CONTEXT(ctx, CONTEXT_ALL); //use this one, otherwise fails on WinXp!
+  TSymLock lock;
+  EnsureModuleSymbolsLoaded();
+  cap->count=WalkContext(GetCurrentThread(),ctx,cap->frames,MaxCallFrames,1+skip);
+  return true;
+}
+
+bool __fastcall dcapturethread(HANDLE hThread, const CONTEXT *context, TCallCapture *cap)
+{ cap->count=0;
+  densureinit(); if (!issucc || hImagehlpDll==NULL) return false;
+  CONTEXT ctx=*context; // StackWalk changes it as it goes
+  TSymLock lock;
+  EnsureModuleSymbolsLoaded();
+  cap->count=WalkContext(hThread,ctx,cap->frames,MaxCallFrames,0);
+  return true;
+}
+
+
+
+
+
+
+//=============================================================================
+// dresolve - turns a capture into text, a line per frame:
+//     pc symbol+0xoffset (file line) [module]
+//   with as much of that as imagehlp knows. A capture can be resolved long
+//   after it was made. Modules loaded in the meantime get picked up, but a
+//   frame whose module has been unloaded since gets only its PC.
+// dresolveall - resolves several captures in one go, taking the lock and
+//   checking the module list only once for all of them.
+// dresolvelater - queues a copy of the capture for the resolver thread,
+//   which resolves whatever has queued up in one go, and then calls
+//   proc(data,callstack) for each, from that thread. The thread is started
+//   the first time it's needed, and dexit waits for it to finish what's
+//   queued. Returns false if it couldn't be started.
+//
+// The same few paths tend to produce most of the callstacks, so there are
+//   two caches in front of imagehlp, both kept under symlock:
+//   stackcache - a whole capture's text, keyed by its frames (with a hash
+//     of them, so that looking one up rarely compares more than that);
+//   framecache - a single frame's text, keyed by its pc and module base, for
+//     captures that are new but share frames with ones seen before.
+//   Each holds at most a set number of entries, and throws out the least
+//   recently used one to make room. dsetcachesize changes the limits (0 turns
+//   a cache off), dclearcache empties both, and dcachestats reports their
+//   sizes and their hits and misses so far. When a module comes or goes,
+//   EnsureModuleSymbolsLoaded has whatever they hold about it dropped.
+//=============================================================================
+//
+template <class K, class V> class TLruCache
+{ public:
+  TLruCache(unsigned amax) : max(amax), hits(0), misses(0) {}
+  const V *Find(const K &k)
+  { typename TIndex::iterator i=index.find(k);
+    if (i==index.end()) {misses++; return NULL;}
+    hits++; lru.splice(lru.begin(),lru,i->second.pos);
+    return &i->second.value;
+  }
+  void Add(const K &k, const V &v)
+  { if (max==0) return;
+    std::pair<typename TIndex::iterator,bool> r=index.insert(std::make_pair(k,TEntry()));
+    r.first->second.value=v;
+    if (r.second) {lru.push_front(&r.first->first); r.first->second.pos=lru.begin();}
+    else lru.splice(lru.begin(),lru,r.first->second.pos);
+    Trim();
+  }
+  template <class P> void Erase(const P &pred) // every entry whose key pred is true for
+  { for (typename TIndex::iterator i=index.begin(); i!=index.end(); )
+      if (pred(i->first)) {lru.erase(i->second.pos); index.erase(i++);}
+      else ++i;
+  }
+  void SetMax(unsigned amax) {max=amax; Trim();}
+  void Clear() {index.clear(); lru.clear();}
+  unsigned Count() const {return (unsigned)index.size();}
+  unsigned max, hits, misses;
+protected:
+  typedef std::list<const K*> TLru; // most recently used first
+  struct TEntry {V value; typename TLru::iterator pos;};
+  typedef std::map<K,TEntry> TIndex;
+  TIndex index; TLru lru;
+  void Trim() {while (index.size()>max) {index.erase(*lru.back()); lru.pop_back();}}
+};
+
+struct TStackKey
+{ DWORD hash; TCallCapture cap;
+  bool operator<(const TStackKey &k) const
+  { if (hash!=k.hash) return hash<k.hash;
+    if (cap.count!=k.cap.count) return cap.count<k.cap.count;
+    return memcmp(cap.frames,k.cap.frames,cap.count*sizeof(TCallFrame))<0;
+  }
+};
+typedef std::pair<DWORD,DWORD> TFrameKey; // pc, modbase
+//
+TLruCache<TStackKey,AnsiString> stackcache(256);
+TLruCache<TFrameKey,AnsiString> framecache(4096);
+
+// ForgetModule - drops what's cached about a module that has come or gone
+struct TFrameInModule {DWORD base; bool operator()(const TFrameKey &k) const {return k.second==base;}};
+struct TStackInModule
+{ DWORD base;
+  bool operator()(const TStackKey &k) const
+  { for (int i=0; i<k.cap.count; i++) if (k.cap.frames[i].modbase==base) return true;
+    return false;
+  }
+};
+void __fastcall ForgetModule(DWORD base)
+{ TFrameInModule fm={base}; framecache.Erase(fm);
+  TStackInModule sm={base}; stackcache.Erase(sm);
+}
+
+DWORD __fastcall HashCapture(const TCallCapture &cap)
+{ DWORD h=2166136261UL; // FNV-1a, over the pcs and module bases
+  const BYTE *p=(const BYTE*)cap.frames, *e=p+cap.count*sizeof(TCallFrame);
+  for (; p<e; p++) h=(h^*p)*16777619UL;
+  return h;
+}
+
+// TFrameResolver - what ResolveFrame keeps from one frame to the next
+typedef struct {IMAGEHLP_MODULE Module; DWORD modfor; bool modok;} TFrameResolver;
+
+AnsiString __fastcall ResolveFrame(const TCallFrame &f, TFrameResolver &fr)
+{ HANDLE hProcess=GetCurrentProcess();
+  AnsiString desc="";
+  if (f.pc!=0) desc=desc+IntToHex((int)f.pc,8)+" ";
+  if (f.pc==0 || f.modbase==0 || !usesyms) return desc;
+  // Frames come in runs from the same module, so only ask when it changes
+  if (f.modbase!=fr.modfor)
+  { fr.modok=!!pSymGetModuleInfo(hProcess,f.pc,&fr.Module); fr.modfor=f.modbase;
+    if (!fr.modok) dble("SymGetModuleInfo failed.");
+  }
+  if (!fr.modok || fr.Module.BaseOfImage!=f.modbase) return desc;
+  // First, the symbol
+  union {IMAGEHLP_SYMBOL sym; char buf[sizeof(IMAGEHLP_SYMBOL)+MAX_PATH];} symbuf;
+  IMAGEHLP_SYMBOL *pSym=&symbuf.sym;
+  ZeroMemory(pSym,sizeof(symbuf)); pSym->SizeOfStruct=sizeof(IMAGEHLP_SYMBOL); pSym->MaxNameLength=MAX_PATH;
+  DWORD offsetFromSymbol=0;
+  BOOL bres=pSymGetSymFromAddr(hProcess,f.pc,&offsetFromSymbol,pSym);
+  if (!bres) {if (GetLastError()!=487) dble("SymGetSymFromAddr: failed.");}
+  else
+  { char undFullName[MAX_PATH];
+    pUnDecorateSymbolName(pSym->Name,undFullName,MAX_PATH,UNDNAME_COMPLETE);
+    desc=desc+AnsiString(undFullName);
+    if (offsetFromSymbol!=0) desc=desc+"+0x"+IntToHex((int)offsetFromSymbol,8);
+  }
+  // Then the line number
+  if (pSymGetLineFromAddr!=NULL) // only present in NT5
+  { IMAGEHLP_LINE Line; ZeroMemory(&Line,sizeof(Line)); Line.SizeOfStruct=sizeof(Line);
+    bres=pSymGetLineFromAddr(hProcess,f.pc,&offsetFromSymbol,&Line);
+    if (!bres) {if (GetLastError()!=487) dble("SymGetLineFromAddr failed.");}
+    else desc=desc+" ("+AnsiString(Line.FileName)+" "+Line.LineNumber+")";
+  }
+  // and the module
+  return desc+" ["+AnsiString(fr.Module.ModuleName)+"]";
+}
+
+AnsiString __fastcall ResolveCapture(const TCallCapture &cap)
+{ TStackKey key; key.hash=HashCapture(cap);
+  key.cap.count=cap.count; memcpy(key.cap.frames,cap.frames,cap.count*sizeof(TCallFrame));
+  const AnsiString *hit=stackcache.Find(key);
+  if (hit!=NULL) return *hit;
   //
-  if (GetLastError()!=0) dble("StackWalk: had some error or other.");
-  free(pSym);
+  TFrameResolver fr; ZeroMemory(&fr.Module,sizeof(fr.Module)); fr.Module.SizeOfStruct=sizeof(fr.Module);
+  fr.modfor=0; fr.modok=false;
+  AnsiString callstack="";
+  for (int i=0; i<cap.count; i++)
+  { const TCallFrame &f=cap.frames[i];
+    TFrameKey fkey(f.pc,f.modbase);
+    const AnsiString *fhit=framecache.Find(fkey);
+    if (fhit!=NULL) {callstack=callstack+*fhit+"\r\n"; continue;}
+    AnsiString desc=ResolveFrame(f,fr);
+    framecache.Add(fkey,desc);
+    callstack=callstack+desc+"\r\n";
+  }
+  stackcache.Add(key,callstack);
   return callstack;
 }
 
+void __fastcall dresolveall(const TCallCapture *caps, int count, AnsiString *callstacks)
+{ densureinit();
+  TSymLock lock;
+  EnsureModuleSymbolsLoaded();
+  for (int i=0; i<count; i++) callstacks[i]=ResolveCapture(caps[i]);
+}
 
+AnsiString __fastcall dresolve(const TCallCapture &cap)
+{ AnsiString callstack;
+  dresolveall(&cap,1,&callstack);
+  return callstack;
+}
+
+void __fastcall dsetcachesize(int maxstacks, int maxframes)
+{ TSymLock lock;
+  stackcache.SetMax(maxstacks<0?0:maxstacks);
+  framecache.SetMax(maxframes<0?0:maxframes);
+}
+
+void __fastcall dclearcache()
+{ TSymLock lock;
+  stackcache.Clear(); framecache.Clear();
+}
+
+void __fastcall dcachestats(TCallCacheStats *stats)
+{ TSymLock lock;
+  stats->stacks=stackcache.Count(); stats->stackhits=stackcache.hits; stats->stackmisses=stackcache.misses;
+  stats->frames=framecache.Count(); stats->framehits=framecache.hits; stats->framemisses=framecache.misses;
+}
+
+
+struct TResolveJob {TCallCapture cap; TResolvedProc proc; void *data; AnsiString callstack; TResolveJob *next;};
+TResolveJob *jobhead=NULL, *jobtail=NULL; // guarded by joblock
+bool stopresolver=false;                  // likewise
+HANDLE hResolver=NULL, hJobEvent=NULL;
+DWORD resolverid=0;
+//
+DWORD WINAPI ResolverThread(LPVOID)
+{ for (;;)
+  { if (WaitForSingleObject(hJobEvent,INFINITE)!=WAIT_OBJECT_0) return 1;
+    EnterCriticalSection(&joblock);
+    TResolveJob *jobs=jobhead; jobhead=NULL; jobtail=NULL;
+    bool stop=stopresolver;
+    LeaveCriticalSection(&joblock);
+    if (jobs!=NULL)
+    { TSymLock lock;
+      EnsureModuleSymbolsLoaded();
+      for (TResolveJob *job=jobs; job!=NULL; job=job->next) job->callstack=ResolveCapture(job->cap);
+    }
+    // The callbacks are made without the lock, so they may capture and resolve too
+    while (jobs!=NULL)
+    { TResolveJob *job=jobs; jobs=jobs->next;
+      job->proc(job->data,job->callstack);
+      delete job;
+    }
+    if (stop) return 0;
+  }
+}
+
+bool __fastcall StartResolver()
+{ densureinit();
+  EnterCriticalSection(&joblock);
+  if (hResolver==NULL)
+  { hJobEvent=CreateEvent(NULL,FALSE,FALSE,NULL);
+    IsMultiThread=true; // as BeginThread would, so that the memory manager locks
+    if (hJobEvent!=NULL) hResolver=CreateThread(NULL,0,ResolverThread,NULL,0,&resolverid);
+    if (hResolver==NULL) {dble("Failed to start the resolver thread."); if (hJobEvent!=NULL) CloseHandle(hJobEvent); hJobEvent=NULL;}
+  }
+  bool ok=(hResolver!=NULL);
+  LeaveCriticalSection(&joblock);
+  return ok;
+}
+
+void __fastcall StopResolver()
+{ if (hResolver==NULL) return;
+  EnterCriticalSection(&joblock); stopresolver=true; LeaveCriticalSection(&joblock);
+  SetEvent(hJobEvent);
+  WaitForSingleObject(hResolver,5000);
+  CloseHandle(hResolver); hResolver=NULL; resolverid=0;
+  CloseHandle(hJobEvent); hJobEvent=NULL;
+  stopresolver=false;
+}
+
+bool __fastcall dresolvelater(const TCallCapture &cap, TResolvedProc proc, void *data)
+{ if (!StartResolver()) return false;
+  TResolveJob *job=new TResolveJob;
+  job->cap.count=cap.count; memcpy(job->cap.frames,cap.frames,cap.count*sizeof(TCallFrame));
+  job->proc=proc; job->data=data; job->next=NULL;
+  EnterCriticalSection(&joblock);
+  if (jobtail==NULL) jobhead=job; else jobtail->next=job;
+  jobtail=job;
+  LeaveCriticalSection(&joblock);
+  SetEvent(hJobEvent);
+  return true;
+}
+
+
+
+
+
+
+//=============================================================================
+// dcallstack - the current thread's callstack, as text. It's just dcapture
+//   followed straight away by dresolve; where the cost matters, e.g. when
+//   logging every exception, capture there and resolve later instead.
+//=============================================================================
+//
+AnsiString __fastcall dcallstack()
+{ TCallCapture cap;
+  if (!dcapture(&cap)) return "<failed to init debugging>";
+  return dresolve(cap);
+}
+
+
+
+
+
+
+
+//=============================================================================
+// ShowCallstack - with a thread, that thread's callstack: from 'context' if
+//   there is one (e.g. from an exception filter), else from the context it
+//   has when it's suspended for the purpose. GetCurrentThread() means the
+//   calling thread, as dcallstack. (Any other handle to the calling thread
+//   would have it suspend itself, so don't.)
+// With hThread NULL it's every thread in the process, for diagnosing hangs.
+//   That's done in three steps:
+//   1. capture - each thread is suspended in turn, just long enough to get
+//      its context and follow its frame chain, and resumed straight away.
+//      Everything that needs memory is allocated beforehand, and the walk
+//      itself makes no calls into imagehlp, which could want a lock or the
+//      heap that the suspended thread holds. The frames are found from EBP,
+//      as RtlCaptureStackBackTrace does for the current thread.
+//   2. resolve - each thread's frames are handed to the resolver thread as
+//      soon as the thread has been resumed, so they're resolved while the
+//      rest are still being captured. imagehlp is single-threaded, so one
+//      resolver is as many as can usefully work at once. Stacks and frames
+//      that several threads share are found in its caches, so each is only
+//      resolved once (unless dsetcachesize has turned those off). If there's
+//      no resolver thread, or this is it, they're resolved here afterwards.
+//   3. report - TStackDump (see stackdump.cpp) gathers the frames of all of
+//      them, and lists threads with the same stack together.
+//=============================================================================
+//
+// WalkFrameChain - the PCs from a suspended thread's context, following the
+//   saved EBPs up its stack, which is taken to be the region that ESP is in.
+//   Memory is read with ReadProcessMemory, so a broken chain just ends it.
+void __fastcall WalkFrameChain(const CONTEXT &ctx, TCallCapture *cap)
+{ TRegionCache rc={0,0,0};
+  HANDLE hProcess=GetCurrentProcess();
+  DWORD lo=0, hi=0;
+  MEMORY_BASIC_INFORMATION mbi;
+  if (VirtualQuery((LPCVOID)ctx.Esp,&mbi,sizeof(mbi))!=0) {lo=ctx.Esp; hi=(DWORD)mbi.BaseAddress+mbi.RegionSize;}
+  int n=0;
+  cap->frames[n].pc=ctx.Eip; cap->frames[n].modbase=ModuleBaseOf(ctx.Eip,rc); n++;
+  DWORD fp=ctx.Ebp;
+  while (n<MaxCallFrames && fp>=lo && fp+8<=hi && (fp&3)==0)
+  { DWORD link[2]; SIZE_T got; // the caller's EBP, and the return address
+    if (!ReadProcessMemory(hProcess,(LPCVOID)fp,link,sizeof(link),&got) || link[1]==0) break;
+    cap->frames[n].pc=link[1]; cap->frames[n].modbase=ModuleBaseOf(link[1],rc); n++;
+    if (link[0]<=fp) break; // the chain only goes up the stack
+    fp=link[0];
+  }
+  cap->count=n;
+}
+
+// SuspendAndCapture - false if the thread couldn't be stopped or read
+bool __fastcall SuspendAndCapture(HANDLE hThread, TCallCapture *cap)
+{ cap->count=0;
+  if (SuspendThread(hThread)==(DWORD)-1) return false;
+  CONTEXT ctx; ZeroMemory(&ctx,sizeof(ctx)); ctx.ContextFlags=CONTEXT_CONTROL;
+  bool ok=!!GetThreadContext(hThread,&ctx);
+  if (ok) WalkFrameChain(ctx,cap);
+  ResumeThread(hThread);
+  return ok;
+}
+
+// QueueDump - has the resolver thread resolve one thread's capture into
+//   'r', and count it off in 'r.wait' when it has
+struct TDumpWait {volatile LONG left; HANDLE done;};
+struct TDumpResult {AnsiString callstack; TDumpWait *wait; bool queued;};
+void __fastcall DumpResolved(void *data, const AnsiString &callstack)
+{ TDumpResult *r=(TDumpResult*)data; r->callstack=callstack;
+  if (InterlockedDecrement(&r->wait->left)==0) SetEvent(r->wait->done);
+}
+void __fastcall QueueDump(const TCallCapture &cap, TDumpResult &r, bool later)
+{ r.queued=false;
+  if (!later || cap.count==0) return;
+  InterlockedIncrement(&r.wait->left);
+  r.queued=dresolvelater(cap,DumpResolved,&r);
+  if (!r.queued) InterlockedDecrement(&r.wait->left);
+}
+
+// ListThreads - the ids of the process's threads, other than this one
+void __fastcall ListThreads(std::vector<DWORD> &ids)
+{ if (hToolHelp==NULL || pThread32First==NULL || pThread32Next==NULL) return;
+  HANDLE hSnap=pCreateToolhelp32Snapshot(TH32CS_SNAPTHREAD,0);
+  if (hSnap==(HANDLE)-1) return;
+  DWORD pid=GetCurrentProcessId(), self=GetCurrentThreadId();
+  THREADENTRY32 te; ZeroMemory(&te,sizeof(te)); te.dwSize=sizeof(te);
+  bool keepgoing = !!pThread32First(hSnap,&te);
+  while (keepgoing)
+  { if (te.th32OwnerProcessID==pid && te.th32ThreadID!=self) ids.push_back(te.th32ThreadID);
+    keepgoing = !!pThread32Next(hSnap,&te);
+  }
+  CloseHandle(hSnap);
+}
+
+AnsiString __fastcall AllCallstacks()
+{ std::vector<DWORD> ids; ListThreads(ids);
+  std::vector<HANDLE> handles(ids.size(),(HANDLE)NULL);
+  for (size_t i=0; i<ids.size(); i++) handles[i]=OpenThread(THREAD_SUSPEND_RESUME|THREAD_GET_CONTEXT|THREAD_QUERY_INFORMATION,FALSE,ids[i]);
+  std::vector<TCallCapture> caps(ids.size()+1);
+  std::vector<bool> got(ids.size(),false);
+  TDumpWait wait; wait.left=1; wait.done=CreateEvent(NULL,FALSE,FALSE,NULL); // the 1 is ours, until all are queued
+  std::vector<TDumpResult> results(caps.size());
+  for (size_t i=0; i<results.size(); i++) results[i].wait=&wait;
+  bool later = wait.done!=NULL && GetCurrentThreadId()!=resolverid && StartResolver();
+  //
+  // 1. capture: this thread first, then each of the others, each queued
+  // for the resolver once it's running again
+  dcapture(&caps[0],1);
+  QueueDump(caps[0],results[0],later);
+  for (size_t i=0; i<ids.size(); i++)
+  { if (handles[i]!=NULL) got[i]=SuspendAndCapture(handles[i],&caps[i+1]);
+    QueueDump(caps[i+1],results[i+1],later);
+  }
+  for (size_t i=0; i<ids.size(); i++) if (handles[i]!=NULL) CloseHandle(handles[i]);
+  //
+  // 2. resolve: wait for the resolver, and do any it didn't take here
+  if (InterlockedDecrement(&wait.left)!=0) WaitForSingleObject(wait.done,INFINITE);
+  if (wait.done!=NULL) CloseHandle(wait.done);
+  for (size_t i=0; i<caps.size(); i++)
+    if (!results[i].queued && caps[i].count>0) results[i].callstack=dresolve(caps[i]);
+  //
+  // 3. report. Each callstack has a line per frame, which is that frame's text.
+  std::map<TFrameKey,std::string> texts;
+  for (size_t i=0; i<caps.size(); i++)
+  { const char *p=results[i].callstack.c_str();
+    for (int j=0; j<caps[i].count && *p!=0; j++)
+    { const char *e=strstr(p,"\r\n"); if (e==NULL) e=p+strlen(p);
+      texts[TFrameKey(caps[i].frames[j].pc,caps[i].frames[j].modbase)]=std::string(p,e);
+      p = (*e!=0) ? e+2 : e;
+    }
+  }
+  TStackDump dump;
+  std::vector<TDumpFrame> frames(MaxCallFrames);
+  for (size_t i=0; i<caps.size(); i++)
+  { const TCallCapture &cap=caps[i];
+    for (int j=0; j<cap.count; j++) {frames[j].pc=cap.frames[j].pc; frames[j].modbase=cap.frames[j].modbase;}
+    DWORD id = (i==0) ? GetCurrentThreadId() : ids[i-1];
+    std::string note = (i==0) ? "(this one)" : (handles[i-1]==NULL ? "<couldn't open it>" : (!got[i-1] ? "<couldn't suspend it, or get its context>" : ""));
+    dump.AddThread(id,&frames[0],cap.count,note);
+  }
+  dump.Prepare();
+  const std::vector<TDumpFrame> &uf=dump.Frames();
+  for (size_t i=0; i<uf.size(); i++) dump.SetText(i,texts[TFrameKey(uf[i].pc,uf[i].modbase)].c_str());
+  return AnsiString(dump.Report().c_str());
+}
+
+AnsiString ShowCallstack(HANDLE hThread, CONTEXT *context)
+{ densureinit(); if (!issucc) return "<failed to init debugging>";
+  if (hThread==NULL) return AllCallstacks();
+  TCallCapture cap; bool ok;
+  if (context!=NULL) ok=dcapturethread(hThread,context,&cap);
+  else if (hThread==GetCurrentThread()) ok=dcapture(&cap);
+  else ok=SuspendAndCapture(hThread,&cap);
+  if (!ok) return "<failed to get context>";
+  return dresolve(cap);
+}
@@ -2,6 +2,26 @@
 #define callstackH
 
 AnsiString __fastcall dcallstack();
-AnsiString ShowCallstack(HANDLE hThread, CONTEXT *context);
+AnsiString ShowCallstack(HANDLE hThread, CONTEXT *context); // hThread NULL: every thread
+
+// Capturing and resolving separately: dcapture is cheap enough to call on
+// every exception, and the captures can be turned into text later, in bulk
+// or on the resolver thread.
+const int MaxCallFrames=62; // RtlCaptureStackBackTrace's limit on XP
+typedef struct {DWORD pc; DWORD modbase;} TCallFrame;
+typedef struct {int count; TCallFrame frames[MaxCallFrames];} TCallCapture;
+typedef void (__fastcall *TResolvedProc)(void *data, const AnsiString &callstack);
+//
+bool __fastcall dcapture(TCallCapture *cap, int skip=0);
+bool __fastcall dcapturethread(HANDLE hThread, const CONTEXT *context, TCallCapture *cap);
+AnsiString __fastcall dresolve(const TCallCapture &cap);
+void __fastcall dresolveall(const TCallCapture *caps, int count, AnsiString *callstacks);
+bool __fastcall dresolvelater(const TCallCapture &cap, TResolvedProc proc, void *data);
+//
+// The resolved text is cached, per whole callstack and per frame
+typedef struct {unsigned stacks, stackhits, stackmisses, frames, framehits, framemisses;} TCallCacheStats;
+void __fastcall dsetcachesize(int maxstacks, int maxframes); // 256 and 4096 to start with
+void __fastcall dclearcache();
+void __fastcall dcachestats(TCallCacheStats *stats);
 
 #endif
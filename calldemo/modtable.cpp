@@ -0,0 +1,42 @@
+#include <algorithm>
+#pragma hdrstop
+#include "modtable.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//=============================================================================
+// TModuleTable::Update -- sorts 'current', and walks it alongside the old
+//   table, as in a merge: an entry only in 'current' is added, one only in
+//   the old table is removed. A module unloaded and another loaded at the
+//   same base differs in size or timestamp, so it shows up as one of each.
+//   An entry in both keeps the old one's names. Afterwards the table is
+//   'current', and 'current' gets the old table's storage, so that calling
+//   it again and again with the same vector doesn't keep allocating.
+//=============================================================================
+//
+void TModuleTable::Update(std::vector<TModuleEntry> &current, std::vector<TModuleEntry> *added, std::vector<TModuleEntry> *removed)
+{ added->clear(); removed->clear();
+  std::sort(current.begin(),current.end());
+  current.erase(std::unique(current.begin(),current.end()),current.end());
+  size_t i=0, j=0;
+  while (i<modules.size() || j<current.size())
+  { if (j==current.size() || (i<modules.size() && modules[i]<current[j])) removed->push_back(modules[i++]);
+    else if (i==modules.size() || current[j]<modules[i]) added->push_back(current[j++]);
+    else
+    { current[j].imageName.swap(modules[i].imageName);
+      current[j].moduleName.swap(modules[i].moduleName);
+      i++; j++;
+    }
+  }
+  modules.swap(current);
+  current.clear();
+}
+
+// Find -- the entry for that module. A rebuilt dll loaded at the same base
+//   often has the same size too, so the timestamp has to match as well.
+const TModuleEntry *TModuleTable::Find(unsigned long baseAddress, unsigned long size, unsigned long timeStamp) const
+{ TModuleEntry key; key.baseAddress=baseAddress; key.size=size; key.timeStamp=timeStamp;
+  std::vector<TModuleEntry>::const_iterator i=std::lower_bound(modules.begin(),modules.end(),key);
+  if (i==modules.end() || !(*i==key)) return NULL;
+  return &*i;
+}
@@ -0,0 +1,36 @@
+#ifndef modtableH
+#define modtableH
+
+#include <string>
+#include <vector>
+
+// TModuleEntry -- a module loaded in the process. Two entries with the same
+// base, size and timestamp are taken to be the same module.
+struct TModuleEntry
+{ std::string imageName, moduleName;
+  unsigned long baseAddress, size, timeStamp;
+  bool operator<(const TModuleEntry &m) const
+  { if (baseAddress!=m.baseAddress) return baseAddress<m.baseAddress;
+    if (size!=m.size) return size<m.size;
+    return timeStamp<m.timeStamp;
+  }
+  bool operator==(const TModuleEntry &m) const {return baseAddress==m.baseAddress && size==m.size && timeStamp==m.timeStamp;}
+};
+
+// TModuleTable -- the modules that were loaded as of the last Update, sorted
+// by base. Update takes the ones loaded now, in any order, and reports which
+// of them are new, and which of the old ones have gone. A module that's still
+// there keeps its entry, names and all, so the caller needn't fill in the
+// names of one that Find already knows by base, size and timestamp. It knows nothing of Windows, so it
+// can be exercised with made-up module lists (see modtabletest.cpp).
+class TModuleTable
+{ public:
+  void Update(std::vector<TModuleEntry> &current, std::vector<TModuleEntry> *added, std::vector<TModuleEntry> *removed);
+  const TModuleEntry *Find(unsigned long baseAddress, unsigned long size, unsigned long timeStamp) const; // NULL if there's none
+  void Clear() {modules.clear();}
+  const std::vector<TModuleEntry> &Modules() const {return modules;}
+protected:
+  std::vector<TModuleEntry> modules;
+};
+
+#endif
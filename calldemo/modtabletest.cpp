@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#pragma hdrstop
+#include "modtable.h"
+
+//=============================================================================
+// modtabletest -- checks TModuleTable::Update against made-up module lists.
+// Not part of calldemo; it needs nothing from Windows, so build and run it
+// on its own, e.g.
+//   bcc32 modtabletest.cpp modtable.cpp
+//   g++ modtabletest.cpp modtable.cpp -o modtabletest
+// It prints each check that fails, and exits with 1 if any did.
+//=============================================================================
+
+static int failures=0;
+#define CHECK(c) do { if (!(c)) {printf("%s(%d): failed: %s\n",__FILE__,__LINE__,#c); failures++;} } while (0)
+
+static TModuleEntry Mod(const char *name, unsigned long base, unsigned long size, unsigned long timeStamp)
+{ TModuleEntry e;
+  e.imageName=std::string("c:\\app\\")+name;
+  e.moduleName=name;
+  e.baseAddress=base; e.size=size; e.timeStamp=timeStamp;
+  return e;
+}
+
+int main()
+{ TModuleTable table;
+  std::vector<TModuleEntry> cur, added, removed;
+
+  // an empty list, before anything is loaded, changes nothing
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==0 && removed.size()==0 && table.Modules().size()==0);
+
+  // the first list: all of it is added, in order of base, and a module
+  // listed twice only once
+  cur.push_back(Mod("b.dll",0x20000000,0x1000,1));
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  cur.push_back(Mod("c.dll",0x30000000,0x2000,1));
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==3 && removed.size()==0);
+  CHECK(table.Modules().size()==3);
+  CHECK(added.size()==3 && added[0].baseAddress==0x00400000 && added[1].baseAddress==0x20000000 && added[2].baseAddress==0x30000000);
+  CHECK(cur.size()==0);
+
+  // the same modules again, in another order: nothing to do
+  cur.push_back(Mod("c.dll",0x30000000,0x2000,1));
+  cur.push_back(Mod("b.dll",0x20000000,0x1000,1));
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==0 && removed.size()==0 && table.Modules().size()==3);
+
+  // one found by base, size and timestamp, with its names left out, keeps
+  // the names it had
+  const TModuleEntry *known=table.Find(0x20000000,0x1000,1);
+  CHECK(known!=NULL && known->moduleName=="b.dll");
+  CHECK(table.Find(0x20000000,0x2000,1)==NULL && table.Find(0x20001000,0x1000,1)==NULL);
+  CHECK(table.Find(0x20000000,0x1000,2)==NULL); // a rebuilt b.dll isn't the one we know
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  cur.push_back(Mod("c.dll",0x30000000,0x2000,1));
+  TModuleEntry nameless; nameless.baseAddress=0x20000000; nameless.size=0x1000; nameless.timeStamp=known->timeStamp;
+  cur.push_back(nameless);
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==0 && removed.size()==0);
+  known=table.Find(0x20000000,0x1000,1);
+  CHECK(known!=NULL && known->moduleName=="b.dll" && known->imageName=="c:\\app\\b.dll");
+
+  // b.dll unloaded, d.dll loaded, and c.dll replaced by a new build at the
+  // same base and size: c.dll shows up as both removed and added. Its new
+  // timestamp means Find doesn't know it, so it comes with its names.
+  CHECK(table.Find(0x30000000,0x2000,2)==NULL);
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  cur.push_back(Mod("c.dll",0x30000000,0x2000,2));
+  cur.push_back(Mod("d.dll",0x40000000,0x1000,1));
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==2 && removed.size()==2);
+  if (added.size()==2 && removed.size()==2)
+  { CHECK(added[0].moduleName=="c.dll" && added[0].timeStamp==2);
+    CHECK(added[1].moduleName=="d.dll");
+    CHECK(removed[0].moduleName=="b.dll");
+    CHECK(removed[1].moduleName=="c.dll" && removed[1].timeStamp==1);
+  }
+  CHECK(table.Modules().size()==3);
+
+  // an empty list now means every module has gone
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==0 && removed.size()==3 && table.Modules().size()==0);
+
+  // and after Clear, everything is new again
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  table.Update(cur,&added,&removed);
+  table.Clear();
+  cur.push_back(Mod("app.exe",0x00400000,0x9000,1));
+  table.Update(cur,&added,&removed);
+  CHECK(added.size()==1 && removed.size()==0);
+
+  if (failures==0) printf("modtabletest: all passed\n");
+  return failures==0 ? 0 : 1;
+}
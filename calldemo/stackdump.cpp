@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <algorithm>
+#pragma hdrstop
+#include "stackdump.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//=============================================================================
+// TStackDump -- the frames of all the threads are gathered, sorted and made
+//   unique, so that each thread's stack becomes a list of indexes into one
+//   table of distinct frames. Sorting them by module keeps the frames of a
+//   module together for whoever resolves them. Two threads whose index lists
+//   are the same have the same stack, and the later one is grouped with the
+//   earlier. Threads come out in the order they went in, by groups.
+//=============================================================================
+//
+void TStackDump::AddThread(unsigned long threadId, const TDumpFrame *stack, int count, const std::string &note)
+{ threads.push_back(TThread());
+  TThread &t=threads.back();
+  t.id=threadId; t.stack.assign(stack,stack+count); t.note=note; t.group=-1;
+  prepared=false;
+}
+
+void TStackDump::Prepare()
+{ frames.clear();
+  for (size_t i=0; i<threads.size(); i++) frames.insert(frames.end(),threads[i].stack.begin(),threads[i].stack.end());
+  std::sort(frames.begin(),frames.end());
+  frames.erase(std::unique(frames.begin(),frames.end()),frames.end());
+  texts.assign(frames.size(),std::string());
+  //
+  for (size_t i=0; i<threads.size(); i++)
+  { TThread &t=threads[i];
+    t.index.resize(t.stack.size());
+    for (size_t j=0; j<t.stack.size(); j++)
+      t.index[j]=std::lower_bound(frames.begin(),frames.end(),t.stack[j])-frames.begin();
+    t.group=(int)i;
+    for (size_t k=0; k<i; k++)
+    { const TThread &u=threads[k];
+      if (u.group==(int)k && u.index==t.index && u.note==t.note) {t.group=(int)k; break;}
+    }
+  }
+  prepared=true;
+}
+
+size_t TStackDump::Stacks() const
+{ size_t n=0;
+  for (size_t i=0; i<threads.size(); i++) if (threads[i].group==(int)i) n++;
+  return n;
+}
+
+std::string TStackDump::Report() const
+{ if (!prepared) return std::string();
+  char buf[64];
+  sprintf(buf,"%u threads, %u distinct stacks, %u distinct frames\r\n",(unsigned)threads.size(),(unsigned)Stacks(),(unsigned)frames.size());
+  std::string r=buf;
+  for (size_t i=0; i<threads.size(); i++)
+  { const TThread &t=threads[i];
+    if (t.group!=(int)i) continue;
+    r+="\r\n";
+    std::string ids; int n=0;
+    for (size_t k=i; k<threads.size(); k++)
+    { if (threads[k].group!=(int)i) continue;
+      sprintf(buf,"%s%lu",n==0?"":", ",threads[k].id); ids+=buf; n++;
+    }
+    r+=(n==1?"Thread ":"Threads ")+ids+":";
+    if (t.note!="") r+=" "+t.note;
+    r+="\r\n";
+    for (size_t j=0; j<t.index.size(); j++) r+=texts[t.index[j]]+"\r\n";
+  }
+  return r;
+}
@@ -0,0 +1,47 @@
+#ifndef stackdumpH
+#define stackdumpH
+
+#include <string>
+#include <vector>
+
+// TDumpFrame -- one frame of a captured stack: where it was, and the base of
+// the module that was there
+struct TDumpFrame
+{ unsigned long pc, modbase;
+  bool operator<(const TDumpFrame &f) const {return modbase!=f.modbase ? modbase<f.modbase : pc<f.pc;}
+  bool operator==(const TDumpFrame &f) const {return pc==f.pc && modbase==f.modbase;}
+};
+
+// TStackDump -- puts many threads' stacks together into one report. Every
+// distinct frame is resolved just once, however many threads it's in, and
+// threads with the very same stack are listed together. It knows nothing of
+// Windows or of symbols, so it can be fed recorded stacks:
+//   AddThread for each thread, then Prepare;
+//   SetText for each of the Frames, with whatever it resolves to;
+//   Report.
+// SetText for different frames may be called from different threads.
+class TStackDump
+{ public:
+  TStackDump() : prepared(false) {}
+  void AddThread(unsigned long threadId, const TDumpFrame *frames, int count, const std::string &note="");
+  void Prepare();
+  const std::vector<TDumpFrame> &Frames() const {return frames;} // distinct, sorted by module then pc
+  void SetText(size_t i, const std::string &text) {texts[i]=text;}
+  std::string Report() const;
+  size_t Threads() const {return threads.size();}
+  size_t Stacks() const;  // distinct stacks among the threads
+protected:
+  struct TThread
+  { unsigned long id;
+    std::vector<TDumpFrame> stack;
+    std::vector<size_t> index; // each frame's index into 'frames'
+    std::string note;          // why there's no stack, if there isn't
+    int group;                 // the first thread with the same stack
+  };
+  std::vector<TThread> threads;
+  std::vector<TDumpFrame> frames;
+  std::vector<std::string> texts;
+  bool prepared;
+};
+
+#endif
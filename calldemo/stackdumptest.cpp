@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#pragma hdrstop
+#include "stackdump.h"
+
+//=============================================================================
+// stackdumptest -- feeds recorded stacks through TStackDump, as ShowCallstack
+// does with live ones, and checks the report. Not part of calldemo; it needs
+// nothing from Windows, so build and run it on its own, e.g.
+//   bcc32 stackdumptest.cpp stackdump.cpp
+//   g++ stackdumptest.cpp stackdump.cpp -o stackdumptest
+// It prints each check that fails, and exits with 1 if any did.
+//=============================================================================
+
+static int failures=0;
+#define CHECK(c) do { if (!(c)) {printf("%s(%d): failed: %s\n",__FILE__,__LINE__,#c); failures++;} } while (0)
+
+int main()
+{ // three frames in two modules, one of them in every stack
+  const TDumpFrame a[]={{0x1010,0x1000},{0x2020,0x2000},{0x1050,0x1000}};
+  const TDumpFrame b[]={{0x3030,0x3000},{0x2020,0x2000}};
+  TStackDump d;
+  d.AddThread(10,a,3);
+  d.AddThread(11,b,2);
+  d.AddThread(12,a,3);
+  d.AddThread(13,NULL,0,"<couldn't suspend it>");
+  d.AddThread(14,a,3);
+  d.AddThread(15,a,3,"<the walk stopped early>"); // same frames, but not the same story
+  d.Prepare();
+
+  // each distinct frame is there once, to be resolved once, sorted by
+  // module and then pc
+  const std::vector<TDumpFrame> &f=d.Frames();
+  CHECK(f.size()==4);
+  if (f.size()==4)
+    CHECK(f[0].pc==0x1010 && f[1].pc==0x1050 && f[2].pc==0x2020 && f[3].pc==0x3030);
+  for (size_t i=0; i<f.size(); i++)
+  { char text[32]; sprintf(text,"fn%lX",f[i].pc);
+    d.SetText(i,text);
+  }
+
+  // 10, 12 and 14 have the same stack, so they're one group; 15 has it too,
+  // but its note keeps it out of that group
+  CHECK(d.Threads()==6);
+  CHECK(d.Stacks()==4);
+  std::string r=d.Report();
+  std::string expected=
+    "6 threads, 4 distinct stacks, 4 distinct frames\r\n"
+    "\r\n"
+    "Threads 10, 12, 14:\r\n"
+    "fn1010\r\n"
+    "fn2020\r\n"
+    "fn1050\r\n"
+    "\r\n"
+    "Thread 11:\r\n"
+    "fn3030\r\n"
+    "fn2020\r\n"
+    "\r\n"
+    "Thread 13: <couldn't suspend it>\r\n"
+    "\r\n"
+    "Thread 15: <the walk stopped early>\r\n"
+    "fn1010\r\n"
+    "fn2020\r\n"
+    "fn1050\r\n";
+  CHECK(r==expected);
+  if (r!=expected) printf("got:\n%s\nexpected:\n%s\n",r.c_str(),expected.c_str());
+  CHECK(r.find("Thread 15:")!=std::string::npos && r.find("14, 15")==std::string::npos);
+
+  // no threads at all still makes a report
+  TStackDump empty;
+  empty.Prepare();
+  CHECK(empty.Frames().size()==0 && empty.Stacks()==0);
+  CHECK(empty.Report().find("0 threads, 0 distinct stacks, 0 distinct frames")==0);
+
+  if (failures==0) printf("stackdumptest: all passed\n");
+  return failures==0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <glob.h>
+#endif
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "vclshim.h"
+#pragma hdrstop
+#include "batch.h"
+#include "workers.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// batch -- converting many images in one process. Build scripts have
+// hundreds of small DLLs and packages per release; running them all through
+// one process saves a process start for each, and lets the conversions
+// share the cores.
+//============================================================================
+
+// FindImages -- the files that match a * or ? pattern, sorted by name.
+static void FindImages(AnsiString pat,std::vector<AnsiString> *found)
+{
+#ifdef _WIN32
+  AnsiString dir = ExtractFilePath(pat);
+  WIN32_FIND_DATA fd;
+  HANDLE h = FindFirstFile(pat.c_str(),&fd);
+  if (h==INVALID_HANDLE_VALUE)
+	return;
+  do
+  { if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)==0)
+	  found->push_back(dir+fd.cFileName);
+  } while (FindNextFile(h,&fd));
+  FindClose(h);
+#else
+  glob_t g;
+  if (glob(pat.c_str(),0,NULL,&g)==0)
+  { for (size_t i=0; i<g.gl_pathc; i++)
+	  if (FileExists(g.gl_pathv[i]))
+		found->push_back(g.gl_pathv[i]);
+  }
+  globfree(&g);
+#endif
+  std::sort(found->begin(),found->end());
+}
+
+// ExpandImageName -- a single name or pattern, i.e. not a response file
+static bool ExpandImageName(AnsiString name,std::vector<AnsiString> *files,AnsiString &err)
+{
+  if (name.Pos("*")!=0 || name.Pos("?")!=0)
+  {
+	std::vector<AnsiString> found;
+	FindImages(name,&found);
+	if (found.size()==0)
+	{
+	  err="No files match '"+name+"'";
+	  return false;
+	}
+	files->insert(files->end(),found.begin(),found.end());
+	return true;
+  }
+  const char *exts[] = {".exe",".dll",".bpl"};
+  for (int i=0; i<3 && !FileExists(name); i++)
+	if (FileExists(name+exts[i]))
+	  name=name+exts[i];
+  files->push_back(name); // if it doesn't exist, convert says so
+  return true;
+}
+
+bool ExpandImageArg(AnsiString arg,std::vector<AnsiString> *files,AnsiString &err)
+{
+  if (arg.SubString(1,1)!="@")
+	return ExpandImageName(arg,files,err);
+  //
+  AnsiString fnlist = arg.SubString(2,arg.Length()-1);
+  FILE *f = fopen(fnlist.c_str(),"rt");
+  if (f==NULL)
+  {
+	err="Couldn't read the response file '"+fnlist+"'";
+	return false;
+  }
+  bool ok=true;
+  std::string line;
+  char buf[1024];
+  while (ok && fgets(buf,sizeof(buf),f)!=NULL)
+  {
+	line += buf;
+	if (line[line.length()-1]!='\n' && !feof(f))
+	  continue; // the rest of a long line is still to come
+	// trim it, and any quotes around it
+	size_t a=0, b=line.length();
+	while (a<b && (unsigned char)line[a]<=' ') a++;
+	while (b>a && (unsigned char)line[b-1]<=' ') b--;
+	if (b-a>=2 && line[a]=='"' && line[b-1]=='"')
+	  {a++; b--;}
+	std::string name = line.substr(a,b-a);
+	line="";
+	if (name=="" || name[0]=='#' || name[0]==';')
+	  continue;
+	ok = ExpandImageName(name.c_str(),files,err);
+  }
+  fclose(f);
+  return ok;
+}
+
+
+// TBatchQueue -- what the workers share. Each of them takes the next job by
+// bumping 'next', until there are none left.
+struct TBatchQueue
+{ std::vector<TBatchJob> *jobs;
+  const TConvertOptions *opts;
+  volatile long next;
+};
+
+static void BatchWorker(void *arg)
+{
+  TBatchQueue *q = (TBatchQueue*)arg;
+  for (;;)
+  {
+	long i = AtomicIncrement(&q->next)-1;
+	if (i>=(long)q->jobs->size())
+	  break;
+	TBatchJob &job = (*q->jobs)[i];
+	if (job.err!="")
+	  continue; // refused before it started
+	try
+	{
+	  job.num = convert(job.exe,job.err,q->opts);
+	}
+	catch (...)
+	{
+	  job.num = 0;
+	  job.err = "Unexpected failure while converting '"+job.exe+"'";
+	}
+  }
+}
+
+// RefuseSharedOutputs -- images with the same name but another extension,
+// like foo.exe and foo.dll, share foo.map, foo.dbg and foo.m2dcache. Two
+// workers writing those at once would leave them corrupt, and only one of
+// the images can match the map anyway, so the later one is refused.
+static void RefuseSharedOutputs(std::vector<TBatchJob> *jobs)
+{
+  std::vector<AnsiString> dbgs(jobs->size());
+  for (size_t i=0; i<jobs->size(); i++)
+  { TBatchJob &job = (*jobs)[i];
+	dbgs[i] = ChangeFileExt(ExpandFileName(job.exe),".dbg");
+	for (size_t j=0; j<i; j++)
+	  if (SameFileName(dbgs[j],dbgs[i]))
+	  { job.num = 0;
+		job.err = "It would write the same "+ExtractFileName(dbgs[i])+" as "+(*jobs)[j].exe+"; convert it on its own";
+		break;
+	  }
+  }
+}
+
+int ConvertBatch(std::vector<TBatchJob> *jobs,const TConvertOptions *opts,int threads)
+{
+  RefuseSharedOutputs(jobs);
+  TBatchQueue q;
+  q.jobs=jobs;
+  q.opts=opts;
+  q.next=0;
+  int n = (threads<=0) ? NumberOfCores() : threads;
+  if (n>(int)jobs->size())
+	n=(int)jobs->size();
+  if (n<1)
+	n=1;
+  std::vector<void*> args(n,&q); // they all work off the one queue
+  RunWorkers(n,BatchWorker,&args[0]);
+  //
+  int failed=0;
+  for (size_t i=0; i<jobs->size(); i++)
+	if ((*jobs)[i].err!="")
+	  failed++;
+  return failed;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,30 @@
+#ifndef batchH
+#define batchH
+
+#include <vector>
+#include "convert.h"
+
+// TBatchJob -- one image of a batch, and how its conversion went.
+struct TBatchJob
+{ AnsiString exe;
+  AnsiString err; // empty if it was converted
+  int num;        // symbols converted
+};
+
+// ExpandImageArg -- adds the images named by one command-line argument to
+// 'files'. "@list" reads a response file, one name or pattern per line, with
+// blank lines and lines starting with '#' or ';' skipped. A name with * or ?
+// in it is a pattern, and adds the files that match (sorted by name). Any
+// other name is taken as is, except that .exe, .dll or .bpl is tried when the
+// name doesn't exist without one. Returns false, with 'err' saying why, if a
+// response file can't be read or a pattern matches nothing.
+bool ExpandImageArg(AnsiString arg,std::vector<AnsiString> *files,AnsiString &err);
+
+// ConvertBatch -- converts every job's image, on 'threads' workers at once
+// (0 means one per core). Each job gets its own result, and one failing
+// doesn't stop the others. An image whose .dbg would be the same file as an
+// earlier job's, e.g. foo.dll after foo.exe, fails without being converted.
+// Returns the number of jobs that failed.
+int ConvertBatch(std::vector<TBatchJob> *jobs,const TConvertOptions *opts,int threads);
+
+#endif
@@ -1,12 +1,22 @@
-#include <windows.h>
-#include <imagehlp.h>
 #include <stdio.h>
-#include <system.hpp>
-#include <sysutils.hpp>
-#include <classes.hpp>
+#include <string.h>
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <deque>
+#include "vclshim.h"
+#include "peimage.h"
 #include "cvexefmt.h"
 #pragma hdrstop
 #include "convert.h"
+#include "mapline.h"
+#include "workers.h"
+#include "mmfile.h"
+#include "namearena.h"
+#include "dbgcache.h"
+#include "mapstream.h"
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 
@@ -14,140 +24,302 @@
 // Convert -- converts Borland's MAP file format, into Microsoft's DBG format,
 // and marks the executable as 'debug-stripped'. See readme.txt for a discussion.
 // This code is (c) 2000-2002 Lucian Wischik.
-//============================================================================
-
-//============================================================================
-// First, just a small debugging function and some code for dynamic-loading dll
-// and an init and automatic-exit routine
-//============================================================================
-AnsiString __fastcall le()
-{ LPVOID lpMsgBuf;
-  FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,NULL,GetLastError(),MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),(LPTSTR) &lpMsgBuf,0,NULL);
-  AnsiString s=AnsiString((char*)lpMsgBuf);
-  LocalFree( lpMsgBuf );
-  while (s[s.Length()]=='\r' || s[s.Length()]=='\n') s=s.SubString(1,s.Length()-1);
-  return s;
-}
-//
-typedef BOOL (__stdcall *MAPANDLOADPROC)(IN LPSTR ImageName, IN LPSTR DllPath, OUT PLOADED_IMAGE LoadedImage, IN BOOL DotDll, IN BOOL ReadOnly);
-typedef BOOL (__stdcall *UNMAPANDLOADPROC)(IN PLOADED_IMAGE LoadedImage);
-MAPANDLOADPROC pMapAndLoad = NULL;
-UNMAPANDLOADPROC pUnMapAndLoad = NULL;
-bool isinit=false, issucc=false; HINSTANCE himagehlp=NULL;
 //
-void iinit()
-{
-  if (isinit)
-	return;
-  isinit=true;
-  issucc=false;
-  himagehlp = LoadLibrary("imagehlp.dll");
-  if (himagehlp==0)
-  {throw new Exception("The system DLL imagehlp.dll was not found.");}
-  pMapAndLoad   = (MAPANDLOADPROC)GetProcAddress(himagehlp,"MapAndLoad");
-  pUnMapAndLoad = (UNMAPANDLOADPROC)GetProcAddress(himagehlp,"UnMapAndLoad");
-  if (pMapAndLoad==0 || pUnMapAndLoad==0)
-  {
-	FreeLibrary(himagehlp);
-	himagehlp=NULL;
-	throw new Exception("The system DLL imagehlp.dll did not have the required functionality.");
-  }
-  issucc=true;
-}
-void iexit()
-{
-  if (himagehlp!=NULL)
-	FreeLibrary(himagehlp);
-  himagehlp=NULL;
-  isinit=false;
-}
-
-class TAutoExitClass
-{
-  public: ~TAutoExitClass()
-  {
-	iexit();
-  }
-} DummyAutoExit;
+// Nothing here depends on imagehlp or on other Windows-only APIs: the PE
+// headers are read by TPEImage and files are mapped through TMappedFile, so
+// the converter builds and runs on other platforms too (see vclshim.h).
+//============================================================================
 
 //============================================================================
 // TDebugFile -- for creating a .DBG file from scratch
-// methods TDebugFile(fnexe,fndbg), AddSymbol(seg,off,name), End()
+// methods TDebugFile(fnexe,fndbg), AddSegment(seg,start,len,class), AddModule(name,seg,off,len),
+// AddSymbol(seg,off,name), AddAlias(name), AddLines(file,lines), End()
 // They return a 'bool' for success or failure. The text string 'err'
 // reports what that error was.
 // End is automatically called by the destructor. But you might want
-// to call it yourself, beforehand, for manual error checking.
-// If file is non-null then it means we have succesfully set things up.
+// to call it yourself, beforehand, for manual error checking. Abort, for
+// when the input turns out to be bad, stops the destructor from calling it,
+// and deletes whatever has been written so far.
+// If 'started' is set then it means we have succesfully set things up.
 //============================================================================
 // File format is as follows:
 // In each column the offsets are relative to the start of that column.
 // Thus, oCv is relative to the file as a whole; cvoSstModule is relative to the
-// start of the SstModule; gpoSym is relative to the start of GlobalPub module.
+// start of the cv block; gpoSym is relative to the start of GlobalPub module.
 //
 // @0. IMAGE_SEPARATE_DEBUG_HEADER -- header of the file. [WriteDBGHeader]
 // @.  numsecs * IMAGE_SECTION_HEADER -- executable's section table. [WriteSectionTable]
 // @.  1 * IMAGE_DEBUG_DIRECTORY -- only one cv-type debug directory. [WriteDbgDirectory]
 // @oCv. <cv-data> -- this is the raw data. of size szCv
-//   @0. OMFSignature -- 'NB09'+omfdir. [in WriteCv]
-//   @8. OMFDirHeader -- subsection directory header. [in WriteCv]
-//   @.  3 * OMFDirEntry -- 3 directory entries: sstModule, sstGlobalPub, sstSegMap. [in WriteCv]
-//   @cvoSstModule. <sst-module>, of length SstModuleSize. [WriteSstModule]
-//     @0. OMFModule
-//     @.  numsecs * OMFSegDest
-//     @.  modname, of size fnsize.
-//   @cvoGlobalPub. <global-pub>, of length GlobalPubSize.
+//   @0. OMFSignature -- 'NB09'+cvoDir. [in WriteCv]
+//   @cvoGlobalPub. <global-pub>, of length szGlobalPub. It comes first, so
+//       that symbols can be written out as they arrive.
 //     @0. OMFSymHash -- [WriteGlobalPubHeader]
-//     @.  nSymbols * var. Variable-sized sympols. [WriteSymbol]
+//     @.  nSymbols * var. Variable-sized sympols: an S_PUB32 for every
+//         one, with the image's section:offset. [WriteSymbol]
 //     @gpoSym. always points to the next symbol to write, is relative to the start of global-pub
-//   @cvoSegMap. <seg-map>, of length SetMapSize. [WriteSegMap]
+//     @.  name hash table, of size cbHSym. [WriteNameHash]
+//     @.  address sort table, of size cbHAddr. [WriteAddrHash]
+//   @cvoSstModule. nmod * <sst-module>, one for each module. [WriteSstModule]
+//     @0. OMFModule
+//     @.  cSeg * OMFSegDesc -- the ranges of the segments that it covers
+//     @.  its name, length-prefixed and padded to 4 bytes.
+//   @cvoSrcModule. <src-module> for each module that has line numbers.
+//       [WriteSrcModule]
+//   @cvoGlobalSym. <global-sym>; only if there are any procedures or data
+//       symbols. [WriteGlobalSym]
+//     @0. OMFSymHash
+//     @.  an S_GPROC32, padded to 4 bytes, and an S_END for each procedure,
+//         and an S_GDATA32 or S_GTHREAD32, padded to 4 bytes, for each data
+//         symbol, in the order added
+//     @.  name hash table and address sort table, as in global-pub
+//   @cvoAliases. <aliases>, of length szAliases; only if there are any.
+//       [WriteAliases]
+//   @cvoSegMap. <seg-map>, of length szSegMap. [WriteSegMap]
 //     @0. OMFSegMap
 //     @.  nsec * OMFSegMapDesc
+//   @cvoDir. OMFDirHeader -- subsection directory header. [WriteDirectory]
+//   @.  cDir * OMFDirEntry -- every sstModule, then the sstSrcModules in
+//       module order, then sstGlobalPub, [sstGlobalSym,] [sstAliases,] and
+//       sstSegMap.
+// Every subsection after global-pub starts on a 4-byte boundary. The
+// directory comes last, so that how many subsections there are needn't be
+// known until End.
+//
+// The modules are the units listed in the map's "Detailed map of segments",
+// which AddModule is given one contribution at a time. A map without that
+// section gets the old single module, named after the executable, that
+// covers every section. Either way, which module a public or a line belongs
+// to follows from its address: the modules' ranges don't overlap, so a
+// consumer can find the module for an address by binary search before it
+// looks at any symbols.
 //
 // Start
 //   * numsec deduced from the executable-image.
-//   * oCv is easy
-//   * cvoSstModule, szSstModule are constant. szModName is easy.
-//   * cvoGlobalPub just comes after, gpoSym initialized to after the OMFSymHash
+//   * oCv is easy. modname is easy.
+//   * cvoGlobalPub just comes after the signature, gpoSym initialized to
+//     after the OMFSymHash
 //     [don't write anything yet]
+// AddSegment
+//   * notes the segment's start, length and class in 'segs', and which
+//     section it's in. It has to be told about the segments before the
+//     symbols in them.
 // AddEntry
-//   * increases gpoSym. [WriteSymbol]
+//   * increases gpoSym. [WriteSymbol] A procedure's S_GPROC32 is kept in
+//     'globalsyms' until End: its length isn't known until the symbol after
+//     it is. A data symbol's record is kept there too.
+// AddModule
+//   * collects the names in 'modules' and the ranges in 'modranges'. End
+//     sorts the ranges, and gives each module its OMFSegDescs from them.
+// AddAlias
+//   * appends an entry to 'aliastable'.
+// AddLines
+//   * just collects them in 'srcfiles', by module.
 // Finish
-//   * cvoSegMap = cvoGlobalPub + gpoSym.
+//   * works out the procedures' lengths, and fills them in.
+//   * cvoSstModule = cvoGlobalPub + gpoSym + cbHSym + cbHAddr, rounded up, and
+//     the rest follow on from there, module by module.
 //     [WriteDBGHeader, WriteSectionTable, WriteDbgDirectory, WriteCv...]
-//     [... WriteSstModule, WriteGlobalPubHeader, WriteSegMap]
+//     [... WriteGlobalPubHeader, WriteNameHash, WriteAddrHash, WriteSstModule,
+//      WriteSrcModule, WriteGlobalSym, WriteSegMap, WriteDirectory]
+//
+// Offsets are kept in 64 bits, so that a .dbg that grows too big is caught
+// rather than wrapped around. NB09 itself only has 32 bits for them, and
+// signed ones at that: the signature's and the directory's offsets are ints.
+// So the whole file has to stay under MaxDbgSize, 2 GB. AddSymbol refuses
+// the first symbol that would take the file past it, and End works out the
+// full size before writing anything and refuses one that's too big, saying
+// which parts take how much. (Splitting the publics over several
+// sstGlobalPubs wouldn't help: they'd be just as far into the file, and
+// debuggers only look at one.) Keeping under that limit also means every
+// position fits the 'long' that fseek takes.
+//
+// All output goes through Seek/Put. Normally these go straight to the file,
+// which means an fseek and a small fwrite for every symbol. With 'inmemory'
+// they go to 'arena' instead, an image of the whole file: AddSymbol appends
+// each record at its final offset, End sizes the arena to oCv+szCv and fills
+// in the headers around the symbols, and the file is then written with one
+// single fwrite. The file isn't even opened until then.
+//
+// The output depends only on the exe's headers and on what was added, in
+// the order it was added: every byte of it, padding and reserved fields
+// included, is set. So the same exe and map always give the same .dbg.
+// With 'skipsame' (which implies 'inmemory'), End compares the finished
+// image with the .dbg that's already there, and doesn't write it if they're
+// the same: the file, and its timestamp, are left alone, so that build
+// caches and rsync see nothing new.
+//
+// However it's written, the file written is fndbg+".tmp". End renames it
+// to fndbg only once it's complete, so an existing .dbg is left as it was by
+// a conversion that fails or is aborted part way; the destructor and Abort
+// delete the part-written one.
+//
+// TPubEntry -- what End needs to know about each symbol to build the hash
+// tables. 'recoff' is relative to the first symbol, i.e. gpoSym-sizeof(OMFSymHash)
+// at the time the symbol was added.
+struct TPubEntry
+{ DWORD recoff;
+  DWORD namesum; // SumUC of its name
+  WORD  seg;
+  DWORD off;
+};
+//
+// TProcEntry -- an S_GPROC32 (and the S_END after it) that AddSymbol has
+// put in 'globalsyms'. seg:off are where it is, from which End works out its
+// length.
+struct TProcEntry
+{ DWORD recoff; // in globalsyms
+  WORD  seg;
+  DWORD off;
+};
 //
+// TSegInfo -- what AddSegment was told about a segment, and where it is in
+// the image (see MapSegment)
+struct TSegInfo
+{ WORD  rectyp; // for the symbols in it; S_PUB32 if we don't know its class
+  DWORD start, len;
+  WORD  sec;    // the image's section that it's in, 1-based; 0 if none
+  DWORD delta;  // and its offset in there
+};
+//
+// TMapLine -- one entry of a map's line-number block (see TMapFile)
+struct TMapLine
+{ unsigned long  line;
+  unsigned short seg;
+  unsigned long  off;
+};
+//
+// TSrcFile -- the line numbers that AddLines has collected for one source
+// file, from however many blocks of the map mention it.
+struct TSrcLine
+{ DWORD off;
+  WORD  seg;
+  WORD  line;
+};
+struct TSrcFile
+{ TNameRef name; // in the TDebugFile's 'names'
+  int imod; // index into modules, or 0 if there are none
+  std::vector<TSrcLine> lines;
+};
+//
+// TDbgModule -- one sstModule: a unit, and the parts of segments it covers.
+// TModRange is one of those parts, for finding the module of an address.
+struct TDbgModule
+{ TNameRef name; // in the TDebugFile's 'names'
+  std::vector<OMFSegDesc> segs;
+};
+struct TModRange
+{ WORD  seg;
+  DWORD off, len;
+  int   imod;
+  bool operator<(const TModRange &r) const
+  { if (seg!=r.seg) return seg<r.seg;
+	return off<r.off;
+  }
+};
+
+// MaxDbgSize -- NB09 offsets are signed 32-bit ints
+const ULONGLONG MaxDbgSize = 0x7FFFFFFFUL;
+
+// MBText -- a size for an error message, e.g. "2047.9 MB"
+static AnsiString MBText(ULONGLONG n)
+{
+  char buf[32];
+  sprintf(buf,"%.1f MB",n/1048576.0);
+  return buf;
+}
+
 class TDebugFile
 {
 public:
-  TDebugFile(AnsiString afnexe,AnsiString afndbg) : file(NULL), ismapped(false), err(""), fnexe(afnexe), fndbg(afndbg) {}
+  TDebugFile(AnsiString afnexe,AnsiString afndbg,bool ainmemory=false,bool askipsame=false) : err(""), unchanged(false), fnexe(afnexe), fndbg(afndbg), fntmp(afndbg+".tmp"), file(NULL), started(false), inmemory(ainmemory||askipsame), skipsame(askipsame), at(0), isended(false), endres(false), naliases(0), modsorted(true) {}
   ~TDebugFile()
   {
 	End();
-	if (ismapped)
-	  pUnMapAndLoad(&image);
-	ismapped=false;
+	image.Close();
 	if (file!=NULL)
 	  fclose(file);
 	file=NULL;
+	if (!endres)
+	  remove(fntmp.c_str()); // what there is of it; the old .dbg stays as it was
   }
-  bool AddSymbol(unsigned short seg, unsigned long offset, AnsiString symbol);
+  bool AddSegment(unsigned short seg, unsigned long start, unsigned long len, const char *cls, int clslen);
+  bool AddModule(const char *name, int namelen, unsigned short seg, unsigned long offset, unsigned long len);
+  bool AddSymbol(unsigned short seg, unsigned long offset, const char *symbol, int symlen);
+  bool AddAlias(const char *symbol, int symlen); // another name for the last symbol added
+  bool AddLines(const char *srcfile, int srcfilelen, const TMapLine *lines, int n);
   bool End(); // to flush the thing to disk.
+  void Abort(); // to throw it away instead: closes the output and deletes it
   AnsiString err;
+  bool unchanged; // End found the .dbg already as it would have written it
 protected:
   AnsiString fnexe, fndbg; // keep a copy of the arguments to the constructor. We don't init until later.
+  AnsiString fntmp;         // where the output goes until End has finished it
   AnsiString modname;
-  unsigned int szModName;
-  LOADED_IMAGE image;
-  bool ismapped; // we load the input exe into this image
+  TPEImage image; // the input exe's headers
   FILE *file; // the output file
-  unsigned long oCv;          // offset to 'cv' data, relative to the start of the output file
-  unsigned long cvoSstModule; // offset to sstModule within cv block
-  unsigned long szSstModule;  // size of that sstModule
-  unsigned long cvoGlobalPub; // offset to GlobalPub within cv block
-  unsigned long gpoSym;       // offset to next-symbol-to-write within GlobalPub block
-  bool check(unsigned long pos,AnsiString s)
-  {
-	if (pos!=(unsigned long)ftell(file) && err!="")
+  bool started;              // EnsureStarted has succeeded
+  bool inmemory;             // build the image in 'arena', and write it in one go
+  bool skipsame;             // and only if the .dbg there isn't the same already
+  std::vector<char> arena;   // the image, if inmemory
+  ULONGLONG at;              // the current output position, if inmemory
+  bool isended, endres;      // End has done its work, and what it returned
+  ULONGLONG oCv;          // offset to 'cv' data, relative to the start of the output file
+  ULONGLONG cvoGlobalPub; // offset to GlobalPub within cv block
+  ULONGLONG gpoSym;       // offset to next-symbol-to-write within GlobalPub block
+  std::vector<TPubEntry> pubs; // one per symbol written, in the order written
+  std::vector<char> globalsyms;   // the S_GPROC32s, S_GDATA32s and S_GTHREAD32s for sstGlobalSym, in the order added
+  std::vector<TPubEntry> globals; // one per record in it, with recoff into it
+  std::vector<TProcEntry> procs;  // and the procedures' own addresses
+  std::vector<TSegInfo> segs;  // indexed by segment number
+  void MapSegment(unsigned short seg);
+  void ToSection(unsigned short seg,unsigned long offset,WORD *sec,DWORD *secoff) const;
+  std::vector<char> aliastable; // the entries of sstAliases, as AddAlias built them
+  DWORD naliases;
+  TNameArena names;                    // of the modules and source files, interned
+  std::vector<TSrcFile> srcfiles;      // line numbers, file by file
+  std::map<std::pair<int,unsigned int>,int> srcindex; // where each (module,file's name) is in srcfiles
+  std::vector<TDbgModule> modules;     // from AddModule, in the order first seen
+  std::map<unsigned int,int> modindex; // where each name is in modules
+  std::vector<TModRange> modranges;    // all their ranges; sorted and trimmed when needed
+  bool modsorted;
+  void SortModRanges();
+  int ModuleOf(unsigned short seg,unsigned long offset);
+  // positions are all below MaxDbgSize, so they fit in a long (and a size_t)
+  void Seek(ULONGLONG pos)
+  {
+	if (inmemory)
+	  at=pos;
+	else
+	  fseek(file,(long)pos,SEEK_SET);
+  }
+  void Put(const void *buf,size_t size)
+  {
+	if (size==0)
+	  return;
+	if (inmemory)
+	{
+	  if (arena.size()<at+size)
+		arena.resize((size_t)(at+size));
+	  memcpy(&arena[(size_t)at],buf,size);
+	  at+=size;
+	}
+	else if (fwrite(buf,size,1,file)!=1 && err=="")
+	  err="Failed to write output file "+fndbg;
+  }
+  ULONGLONG Tell()
+  {
+	return inmemory ? at : (ULONGLONG)ftell(file);
+  }
+  void PadTo(ULONGLONG pos) // zeros up to pos, which is a few bytes on
+  {
+	static const char zeros[4] = {0,0,0,0};
+	while (Tell()<pos)
+	  Put( zeros, (pos-Tell()<4) ? (size_t)(pos-Tell()) : 4 );
+  }
+  bool check(ULONGLONG pos,AnsiString s)
+  {
+	if (pos!=Tell() && err=="")
 	{
 	  err=s;
 	  return false;
@@ -161,190 +333,892 @@ protected:
 
 bool TDebugFile::EnsureStarted()
 {
-  if (file!=NULL)
+  if (started)
 	return true;
   //
-  char c[MAX_PATH];
-  strcpy(c,fnexe.c_str());
-
-  BOOL bres = pMapAndLoad(c,0,&image,false,true);
-  if (bres)
-	ismapped=true;
-  else
+  if (image.FileHeader==NULL && !image.Open(fnexe.c_str()))
   {
-	err="Failed to load executable '"+fnexe+"'";
+	err="Failed to load executable - "+AnsiString(image.err.c_str());
 	return false;
   }
+  if (image.NumberOfSections>=0xFFFF)
+  {
+	err="Too many sections in '"+fnexe+"': "+AnsiString((int)image.NumberOfSections)+", where a .dbg can have at most 65534";
+	return false; // OMFSegDesc only uses 'unsigned short', and segment 0xFFFF is special
+  }
   modname      = ChangeFileExt(ExtractFileName(fnexe),"");
-  szModName    = ((modname.Length()+1)+3) & (~3); // round it up
   oCv          = sizeof(IMAGE_SEPARATE_DEBUG_HEADER) + image.NumberOfSections*sizeof(IMAGE_SECTION_HEADER) + 1*sizeof(IMAGE_DEBUG_DIRECTORY);
-  cvoSstModule = sizeof(OMFSignature) + sizeof(OMFDirHeader) + 3*sizeof(OMFDirEntry);
-  //szSstModule  = offsetof(OMFModule,SegInfo) + image.NumberOfSections*sizeof(OMFSegDesc) + szModName;
-  szSstModule  = offsetof(OMFModule,SegInfo) + image.NumberOfSections*sizeof(OMFSegDesc) + szModName;
-  cvoGlobalPub = cvoSstModule + szSstModule;
+  cvoGlobalPub = sizeof(OMFSignature);
   gpoSym       = sizeof(OMFSymHash);
+  for (size_t i=0; i<segs.size(); i++)
+	MapSegment((unsigned short)i);
 
-  file   = fopen(fndbg.c_str(),"wb");
-  if (file==NULL)
+  if (!inmemory)
   {
-	err="Failed to open output file "+fndbg;
-	return false;
+	file = fopen(fntmp.c_str(),"wb");
+	if (file==NULL)
+	{
+	  err="Failed to open output file "+fndbg;
+	  return false;
+	}
   }
+  started=true;
   return true;
 }
 
 
-bool TDebugFile::AddSymbol(unsigned short seg,unsigned long offset,AnsiString symbol)
+//============================================================================
+// Name hash table, OMFHASH_SUMUC32. It follows the symbols in sstGlobalPub:
+//   WORD  cHash             -- number of buckets
+//   WORD  pad
+//   DWORD bucketoff[cHash]  -- offset of each bucket's chain, from the first chain
+//   DWORD bucketcnt[cHash]  -- number of symbols in each bucket
+//   DWORD chain[nSymbols]   -- offsets of the symbol records, from the first
+//                              symbol, grouped bucket by bucket
+// A name goes into bucket SumUC(name) % cHash: the sum of its upper-cased
+// bytes. So a lookup sums the name it wants and only has to look at one
+// chain, rather than at every public. Within a chain, symbols keep the
+// order in which they were written.
+//============================================================================
+//
+DWORD SumUC(const char *name,int len)
+{
+  DWORD sum=0;
+  for (int i=0; i<len; i++)
+  { unsigned char c=(unsigned char)name[i];
+	sum += (c>='a' && c<='z') ? (DWORD)(c-'a'+'A') : (DWORD)c;
+  }
+  return sum;
+}
+
+void BuildNameHash(const std::vector<TPubEntry> &pubs,std::vector<char> *table)
+{
+  // about four symbols a bucket; the count has to fit in a WORD
+  DWORD nsyms = (DWORD)pubs.size();
+  DWORD cHash = nsyms/4 + 1;
+  if (cHash>0xFFFF)
+	cHash=0xFFFF;
+  table->assign(2*sizeof(WORD) + 2*cHash*sizeof(DWORD) + nsyms*sizeof(DWORD), 0);
+  WORD  *hdr       = (WORD*)&(*table)[0];
+  DWORD *bucketoff = (DWORD*)(hdr+2);
+  DWORD *bucketcnt = bucketoff+cHash;
+  DWORD *chain     = bucketcnt+cHash;
+  hdr[0] = (WORD)cHash;
+  hdr[1] = 0;
+  for (DWORD i=0; i<nsyms; i++)
+	bucketcnt[pubs[i].namesum%cHash]++;
+  DWORD at=0;
+  for (DWORD b=0; b<cHash; b++)
+  {
+	bucketoff[b] = at*sizeof(DWORD);
+	at += bucketcnt[b];
+  }
+  std::vector<DWORD> fill(cHash,0);
+  for (DWORD i=0; i<nsyms; i++)
+  {
+	DWORD b = pubs[i].namesum%cHash;
+	chain[bucketoff[b]/sizeof(DWORD) + fill[b]++] = pubs[i].recoff;
+  }
+}
+
+
+//============================================================================
+// Address sort table, OMFHASH_ADDR32. It follows the name hash table:
+//   WORD  cSeg              -- number of segments
+//   WORD  pad
+//   DWORD segoff[cSeg]      -- offset of each segment's table, from the first table
+//   DWORD segcnt[cSeg]      -- number of symbols in each segment
+//   DWORD table[nSymbols]   -- offsets of the symbol records, from the first
+//                              symbol, segment by segment (1..cSeg) and
+//                              sorted by increasing offset within each
+// So an address can be turned into a symbol by binary search. Symbols at the
+// same address keep the order in which they were written. Symbols whose
+// segment is 0 aren't in any table.
+//============================================================================
+//
+struct TPubAddrLess
+{ const std::vector<TPubEntry> *pubs;
+  bool operator()(DWORD a,DWORD b) const
+  { const TPubEntry &pa=(*pubs)[a], &pb=(*pubs)[b];
+	if (pa.seg!=pb.seg) return pa.seg<pb.seg;
+	return pa.off<pb.off;
+  }
+};
+
+void BuildAddrHash(const std::vector<TPubEntry> &pubs,int numsecs,std::vector<char> *table)
 {
-  EnsureStarted();
-  if (file==NULL)
+  DWORD cSeg = (DWORD)numsecs;
+  std::vector<DWORD> order;
+  order.reserve(pubs.size());
+  for (DWORD i=0; i<(DWORD)pubs.size(); i++)
+	if (pubs[i].seg!=0)
+	{ order.push_back(i);
+	  if (pubs[i].seg>cSeg)
+		cSeg=pubs[i].seg;
+	}
+  TPubAddrLess less; less.pubs=&pubs;
+  std::stable_sort(order.begin(),order.end(),less);
+  //
+  DWORD n = (DWORD)order.size();
+  table->assign(2*sizeof(WORD) + 2*cSeg*sizeof(DWORD) + n*sizeof(DWORD), 0);
+  WORD  *hdr    = (WORD*)&(*table)[0];
+  DWORD *segoff = (DWORD*)(hdr+2);
+  DWORD *segcnt = segoff+cSeg;
+  DWORD *addrs  = segcnt+cSeg;
+  hdr[0] = (WORD)cSeg;
+  hdr[1] = 0;
+  for (DWORD i=0; i<n; i++)
+  {
+	addrs[i] = pubs[order[i]].recoff;
+	segcnt[pubs[order[i]].seg-1]++;
+  }
+  DWORD at=0;
+  for (DWORD g=0; g<cSeg; g++)
+  {
+	segoff[g] = at*sizeof(DWORD);
+	at += segcnt[g];
+  }
+}
+
+
+bool TDebugFile::AddModule(const char *name,int namelen,unsigned short seg,unsigned long offset,unsigned long len)
+{
+  if (len==0)
+	return true; // nothing that an address could fall in
+  TNameRef n = names.Intern(name,namelen);
+  std::map<unsigned int,int>::iterator it = modindex.find(n.off);
+  int m;
+  if (it!=modindex.end())
+	m = it->second;
+  else
+  {
+	m = (int)modules.size();
+	modules.push_back(TDbgModule());
+	modules[m].name = n;
+	modindex[n.off] = m;
+  }
+  TModRange r;
+  r.seg  = seg;
+  r.off  = offset;
+  r.len  = len;
+  r.imod = m;
+  modranges.push_back(r);
+  modsorted=false;
+  return true;
+}
+
+// SortModRanges -- sorts the ranges by address, and trims any that run into
+// the next one. The linker's lengths occasionally overlap by a few bytes, and
+// a consumer's binary search relies on them not doing so.
+static void SortRanges(std::vector<TModRange> *ranges)
+{
+  std::stable_sort(ranges->begin(),ranges->end());
+  for (size_t i=0; i+1<ranges->size(); i++)
+  { TModRange &r=(*ranges)[i], &next=(*ranges)[i+1];
+	if (r.seg==next.seg && r.off+r.len>next.off)
+	  r.len = next.off-r.off; // may leave it empty
+  }
+}
+
+void TDebugFile::SortModRanges()
+{
+  if (modsorted)
+	return;
+  SortRanges(&modranges);
+  modsorted=true;
+}
+
+// ModuleOf -- the module whose range holds seg:offset. An address that
+// isn't in any range (a linker-made symbol, say) goes with the range before
+// it in its segment, or failing that with the first module.
+int TDebugFile::ModuleOf(unsigned short seg,unsigned long offset)
+{
+  if (modranges.size()==0)
+	return 0;
+  SortModRanges();
+  TModRange key;
+  key.seg = seg;
+  key.off = offset;
+  std::vector<TModRange>::iterator i = std::upper_bound(modranges.begin(),modranges.end(),key);
+  if (i==modranges.begin() || (i-1)->seg!=seg)
+	return 0;
+  return (i-1)->imod;
+}
+
+
+//============================================================================
+// Segments. The map's segment table gives each segment's length and class.
+// A symbol in a CODE segment is an S_PUB32 in sstGlobalPub, like any other
+// public, and also an S_GPROC32 (with its S_END) in sstGlobalSym:
+// sstGlobalPub is a table of publics, and readers such as dbghelp skip any
+// other kind of record there. The S_GPROC32 can carry a length: each runs up
+// to the next symbol at a higher address in its segment, or to the end of
+// the segment if there is none. That lets a lookup tell whether an address
+// is actually inside a function, rather than just after one, e.g. in
+// padding or in data that lives in the code segment.
+// Symbols in DATA and BSS segments also get an S_GDATA32, and those in a
+// TLS segment an S_GTHREAD32, since their offsets are into each thread's
+// storage rather than addresses. Those go in sstGlobalSym too, so a lookup
+// for a code address can pass over them by record type alone. Map publics
+// are all global, hence no S_LDATA32s. Segments of any other class only
+// have the S_PUB32s.
+//
+// Every record gives its address as the image's section:offset, which is
+// what sstSegMap describes, rather than as the map's segment:offset. The
+// two don't match: on a Delphi or C++Builder map, BSS (0003) is the tail
+// of .data, and TLS (0004), which starts at 0, is .tls. MapSegment works
+// out which section each segment is in from the start address that the
+// map's segment table gives it. The procedures' lengths and modules, which
+// come from the map, are still worked out in the map's terms.
+//============================================================================
+//
+bool TDebugFile::AddSegment(unsigned short seg,unsigned long start,unsigned long len,const char *cls,int clslen)
+{
+  if (segs.size()<=seg)
+  { TSegInfo none = {S_PUB32,0,0,0,0};
+	segs.resize(seg+1,none);
+  }
+  std::string c(cls,clslen);
+  for (size_t i=0; i<c.length(); i++)
+	if (c[i]>='a' && c[i]<='z') c[i]=(char)(c[i]-'a'+'A');
+  if (c=="CODE" || c=="ICODE") // Delphi's initialization code is ICODE
+	segs[seg].rectyp = S_GPROC32;
+  else if (c=="DATA" || c=="BSS")
+	segs[seg].rectyp = S_GDATA32;
+  else if (c=="TLS")
+	segs[seg].rectyp = S_GTHREAD32;
+  else
+	segs[seg].rectyp = S_PUB32;
+  segs[seg].start = start;
+  segs[seg].len = len;
+  if (started) // otherwise EnsureStarted does, once the image is open
+	for (size_t i=0; i<segs.size(); i++)
+	  MapSegment((unsigned short)i);
+  return true;
+}
+
+// MapSegment -- the section that holds the segment's start address. A TLS
+// segment's offsets are into the thread's copy of .tls. A segment whose
+// start isn't given (some maps have 0 for all of them) is taken to be the
+// section of the same number, as the map's numbering mostly follows the
+// sections'. One that starts outside every section gets section 0, which
+// puts its symbols in no address table.
+void TDebugFile::MapSegment(unsigned short seg)
+{
+  TSegInfo &sg = segs[seg];
+  sg.sec   = 0;
+  sg.delta = 0;
+  int numsecs = image.NumberOfSections;
+  if (sg.rectyp==S_GTHREAD32)
+  { for (int i=0; i<numsecs; i++)
+	  if (strncmp((const char*)image.Sections[i].Name,".tls",IMAGE_SIZEOF_SHORT_NAME)==0)
+		sg.sec = (WORD)(i+1);
+	return;
+  }
+  ULONGLONG base = image.ImageBase();
+  if (sg.start==0)
+  { if (seg<=numsecs)
+	  sg.sec = seg;
+	return;
+  }
+  if (sg.start<base)
+	return;
+  ULONGLONG rva = sg.start-base;
+  for (int i=0; i<numsecs; i++)
+  { const IMAGE_SECTION_HEADER &sh = image.Sections[i];
+	DWORD size = (sh.Misc.VirtualSize>sh.SizeOfRawData) ? sh.Misc.VirtualSize : sh.SizeOfRawData;
+	if (rva>=sh.VirtualAddress && rva-sh.VirtualAddress<size)
+	{ sg.sec   = (WORD)(i+1);
+	  sg.delta = (DWORD)(rva-sh.VirtualAddress);
+	  return;
+	}
+  }
+}
+
+// ToSection -- a map address as the image's section:offset. Segments that
+// AddSegment wasn't told about keep their numbers.
+void TDebugFile::ToSection(unsigned short seg,unsigned long offset,WORD *sec,DWORD *secoff) const
+{
+  if (seg<segs.size())
+  { *sec    = segs[seg].sec;
+	*secoff = segs[seg].delta+offset;
+  }
+  else
+  { *sec    = seg;
+	*secoff = offset;
+  }
+}
+
+bool TDebugFile::AddSymbol(unsigned short seg,unsigned long offset,const char *symbol,int symlen)
+{
+  if (!EnsureStarted() || err!="")
 	return false;
   BYTE buffer[512];
-  PUBSYM32* pPubSym32 = (PUBSYM32*)buffer;
   // nb. that PSUBSYM32 only works with names up to 255 characters. This
   // code is experimental: I don't know what happens if two symbols
   // get truncated down to the same 255char prefix.
-  if (symbol.Length()>255)
-	symbol = symbol.SubString(1,255);
-  DWORD cbSymbol      = symbol.Length();
+  if (symlen>255)
+	symlen = 255;
+  DWORD cbSymbol      = symlen;
+  WORD rectyp = (seg<segs.size()) ? segs[seg].rectyp : (WORD)S_PUB32;
+  WORD sec;
+  DWORD secoff;
+  ToSection(seg,offset,&sec,&secoff);
+  PUBSYM32* pPubSym32 = (PUBSYM32*)buffer;
   DWORD realRecordLen = sizeof(PUBSYM32) + cbSymbol;
   pPubSym32->reclen   = (unsigned short)(realRecordLen - 2);
   pPubSym32->rectyp   = S_PUB32;
-  pPubSym32->off      = offset;
-  pPubSym32->seg      = seg;
+  pPubSym32->off      = secoff;
+  pPubSym32->seg      = sec;
   pPubSym32->typind   = 0;
   pPubSym32->name[0]  = (unsigned char)cbSymbol;
-  lstrcpy( (PSTR)&pPubSym32->name[1], symbol.c_str() );
-  fseek(file, oCv + cvoGlobalPub + gpoSym,SEEK_SET );
-  fwrite( pPubSym32, realRecordLen, 1, file );
+  memcpy( &pPubSym32->name[1], symbol, cbSymbol );
+  // and what its record in sstGlobalSym, if it has one, will take
+  DWORD globalRecordLen = 0;
+  if (rectyp==S_GPROC32)
+	globalRecordLen = ((sizeof(PROCSYM32) + cbSymbol + 3) & ~3) + sizeof(SYMTYPE);
+  else if (rectyp==S_GDATA32 || rectyp==S_GTHREAD32)
+	globalRecordLen = (sizeof(DATASYM32) + cbSymbol + 3) & ~3;
+  if (oCv + cvoGlobalPub + gpoSym + realRecordLen + globalsyms.size() + globalRecordLen > MaxDbgSize)
+  {
+	err="Too many symbols for a .dbg: the first "+AnsiString((int)pubs.size())+" take "+MBText(gpoSym+globalsyms.size())
+	   +", and the .dbg format can't address more than 2 GB. Folding aliases (/aliases) makes fewer of them";
+	return false;
+  }
+  Seek( oCv + cvoGlobalPub + gpoSym );
+  Put( pPubSym32, realRecordLen );
+  TPubEntry pe;
+  pe.recoff  = (DWORD)(gpoSym - sizeof(OMFSymHash));
+  pe.namesum = SumUC(symbol,cbSymbol);
+  pe.seg     = sec;
+  pe.off     = secoff;
+  pubs.push_back(pe);
   gpoSym += realRecordLen;
+  //
+  if (rectyp==S_GPROC32)
+  { // padded to 4 bytes, as everything in sstGlobalSym is. End fills in
+	// len, once it knows where the next procedure starts
+	DWORD procRecordLen = (sizeof(PROCSYM32) + cbSymbol + 3) & ~3;
+	TProcEntry pr;
+	pr.recoff = (DWORD)globalsyms.size();
+	pr.seg    = seg;
+	pr.off    = offset;
+	procs.push_back(pr);
+	pe.recoff = pr.recoff;
+	globals.push_back(pe);
+	globalsyms.resize(globalsyms.size() + procRecordLen + sizeof(SYMTYPE), 0);
+	PROCSYM32* pProcSym32 = (PROCSYM32*)&globalsyms[pr.recoff];
+	pProcSym32->reclen  = (unsigned short)(procRecordLen - 2);
+	pProcSym32->rectyp  = S_GPROC32;
+	pProcSym32->pEnd    = pr.recoff + procRecordLen; // the S_END that follows
+	pProcSym32->off     = secoff;
+	pProcSym32->seg     = sec;
+	pProcSym32->typind  = 0;
+	pProcSym32->name[0] = (unsigned char)cbSymbol;
+	memcpy( &pProcSym32->name[1], symbol, cbSymbol );
+	SYMTYPE* pEnd = (SYMTYPE*)&globalsyms[pr.recoff + procRecordLen];
+	pEnd->reclen = sizeof(SYMTYPE) - 2;
+	pEnd->rectyp = S_END;
+  }
+  else if (rectyp==S_GDATA32 || rectyp==S_GTHREAD32)
+  { // THREADSYM32 is laid out just like DATASYM32
+	DWORD dataRecordLen = (sizeof(DATASYM32) + cbSymbol + 3) & ~3;
+	pe.recoff = (DWORD)globalsyms.size();
+	globals.push_back(pe);
+	globalsyms.resize(globalsyms.size() + dataRecordLen, 0);
+	DATASYM32* pDataSym32 = (DATASYM32*)&globalsyms[pe.recoff];
+	pDataSym32->reclen  = (unsigned short)(dataRecordLen - 2);
+	pDataSym32->rectyp  = rectyp;
+	pDataSym32->off     = secoff;
+	pDataSym32->seg     = sec;
+	pDataSym32->typind  = 0;
+	pDataSym32->name[0] = (unsigned char)cbSymbol;
+	memcpy( &pDataSym32->name[1], symbol, cbSymbol );
+  }
   return true;
 }
 
+//============================================================================
+// Aliases, in a subsection of our own, sstAliases. When convert folds the
+// publics at one address into a single symbol, the other names can be kept
+// here rather than dropped. A consumer that doesn't know the subsection
+// skips it, and sees one unambiguous symbol per address:
+//   DWORD cAlias
+// then for each alias
+//   DWORD symoff   -- offset of its symbol's record, from the first symbol
+//                     in sstGlobalPub, as in the hash tables
+//   BYTE  cbName, then the name
+// padded to 4 bytes at the end. Entries are in order of symoff.
+//============================================================================
+//
+#define sstAliases 0x1a0 // outside the range of CV4's own subsections
 
-bool TDebugFile::End()
+bool TDebugFile::AddAlias(const char *symbol,int symlen)
 {
-  int numsecs = image.NumberOfSections;
-  unsigned long cvoSegMap = cvoGlobalPub + gpoSym;
-  unsigned long szSegMap  = sizeof(OMFSegMap) + numsecs*sizeof(OMFSegMapDesc);
-  unsigned long szCv      = cvoSegMap + szSegMap;
-  if (numsecs>=0xFFFF)
-	return false; // OMFSegDesc only uses 'unsigned short'
-
-  EnsureStarted();
-  if (file==NULL)
+  if (pubs.size()==0)
 	return false;
-  fseek(file,0,SEEK_SET);
+  if (symlen>255)
+	symlen = 255; // as in AddSymbol
+  if (naliases==0)
+	aliastable.assign(sizeof(DWORD),0); // cAlias, filled in by End
+  DWORD symoff = pubs.back().recoff;
+  aliastable.insert(aliastable.end(),(char*)&symoff,(char*)&symoff+sizeof(symoff));
+  aliastable.push_back((char)symlen);
+  aliastable.insert(aliastable.end(),symbol,symbol+symlen);
+  naliases++;
+  return true;
+}
+
+// ProcLengths -- the length of each of 'procs', as described above. Symbols
+// at the same address get the same length.
+struct TProcAddrLess
+{ const std::vector<TProcEntry> *procs;
+  bool operator()(DWORD a,DWORD b) const
+  { const TProcEntry &pa=(*procs)[a], &pb=(*procs)[b];
+	if (pa.seg!=pb.seg) return pa.seg<pb.seg;
+	return pa.off<pb.off;
+  }
+};
+
+void ProcLengths(const std::vector<TProcEntry> &procs,const std::vector<TSegInfo> &segs,std::vector<DWORD> *lens)
+{
+  std::vector<DWORD> order(procs.size());
+  for (DWORD k=0; k<(DWORD)order.size(); k++)
+	order[k]=k;
+  TProcAddrLess less; less.procs=&procs;
+  std::sort(order.begin(),order.end(),less);
+  lens->resize(procs.size());
+  for (size_t i=0; i<order.size(); )
+  {
+	const TProcEntry &p = procs[order[i]];
+	size_t j=i+1; // the first one at a higher address
+	while (j<order.size() && !less(order[i],order[j]))
+	  j++;
+	DWORD end = segs[p.seg].len;
+	if (j<order.size())
+	{ const TProcEntry &next = procs[order[j]];
+	  if (next.seg==p.seg && next.off<end)
+		end = next.off;
+	}
+	DWORD len = (p.off<end) ? end-p.off : 0;
+	for (; i<j; i++)
+	  (*lens)[order[i]] = len;
+  }
+}
+
+
+//============================================================================
+// Line numbers, sstSrcModule. One such subsection per module that has any,
+// with the source files that have lines in that module:
+//   WORD  cFile, cSeg
+//   DWORD baseSrcFile[cFile]  -- offset of each file's table
+//   DWORD start,end[cSeg]     -- the range of code covered in each segment
+//   WORD  seg[cSeg]           -- and which segments those are
+// then for each file
+//   WORD  cSeg, pad
+//   DWORD baseSrcLn[cSeg]     -- offset of each of the file's line tables
+//   DWORD start,end[cSeg]
+//   BYTE  cbName, then the name
+// then for each of those line tables
+//   WORD  Seg, cLnOff
+//   DWORD offset[cLnOff]      -- sorted
+//   WORD  lineNbr[cLnOff]
+// All offsets are from the start of the subsection; each table starts on a
+// 4-byte boundary. A file has one line table per segment, unless it has more
+// than 0xFFFF lines in a segment, in which case they're split over several.
+//============================================================================
+//
+struct TSrcLineLess
+{ bool operator()(const TSrcLine &a,const TSrcLine &b) const
+  { if (a.seg!=b.seg) return a.seg<b.seg;
+	return a.off<b.off;
+  }
+};
+struct TSrcRun {size_t from, n;}; // one line table's share of a file's lines
+
+static void PutW(std::vector<char> *v,WORD w)  {v->insert(v->end(),(char*)&w,(char*)&w+sizeof(w));}
+static void PutD(std::vector<char> *v,DWORD d) {v->insert(v->end(),(char*)&d,(char*)&d+sizeof(d));}
+static void SetD(std::vector<char> *v,size_t at,DWORD d) {memcpy(&(*v)[at],&d,sizeof(d));}
+static void PadD(std::vector<char> *v) {while (v->size()%4!=0) v->push_back(0);}
+static inline ULONGLONG Align4(ULONGLONG x) {return (x+3)&~(ULONGLONG)3;}
+
+// AddLines -- a block of the map covers a single unit, so the whole block
+// goes with the module of its first line. A header file with inline code in
+// it can turn up in several modules, and gets a TSrcFile in each.
+bool TDebugFile::AddLines(const char *srcfile,int srcfilelen,const TMapLine *lines,int n)
+{
+  if (n<=0)
+	return true;
+  TNameRef fname = names.Intern(srcfile,srcfilelen);
+  std::pair<int,unsigned int> key(ModuleOf(lines[0].seg,lines[0].off),fname.off);
+  std::map<std::pair<int,unsigned int>,int>::iterator it = srcindex.find(key);
+  int f;
+  if (it!=srcindex.end())
+	f = it->second;
+  else
+  {
+	f = (int)srcfiles.size();
+	srcfiles.push_back(TSrcFile());
+	srcfiles[f].name = fname;
+	srcfiles[f].imod = key.first;
+	srcindex[key] = f;
+  }
+  for (int i=0; i<n; i++)
+	if (lines[i].line<=0xFFFF) // lineNbr is only a WORD
+	{ TSrcLine sl;
+	  sl.off  = lines[i].off;
+	  sl.seg  = lines[i].seg;
+	  sl.line = (WORD)lines[i].line;
+	  srcfiles[f].lines.push_back(sl);
+	}
+  return true;
+}
+
+// PutName -- a length-prefixed name, truncated to 255 characters
+static void PutName(std::vector<char> *v,const TNameArena &names,TNameRef name)
+{
+  unsigned int len = (name.len>255) ? 255 : name.len;
+  v->push_back((char)len);
+  v->insert(v->end(),names.Ptr(name),names.Ptr(name)+len);
+}
+
+void BuildSrcModule(std::vector<TSrcFile*> &files,const TNameArena &names,std::vector<char> *sub)
+{
+  sub->clear();
+  std::vector< std::vector<TSrcRun> > runs(files.size());
+  std::map<WORD, std::pair<DWORD,DWORD> > segrange; // seg -> start,end
+  for (size_t f=0; f<files.size(); f++)
+  {
+	std::vector<TSrcLine> &ls = files[f]->lines;
+	std::stable_sort(ls.begin(),ls.end(),TSrcLineLess());
+	for (size_t i=0; i<ls.size(); i++)
+	{
+	  if (runs[f].size()==0 || ls[i].seg!=ls[i-1].seg || runs[f].back().n==0xFFFF)
+	  { TSrcRun r; r.from=i; r.n=0;
+		runs[f].push_back(r);
+	  }
+	  runs[f].back().n++;
+	  if (segrange.find(ls[i].seg)==segrange.end())
+		segrange[ls[i].seg] = std::make_pair(ls[i].off,ls[i].off);
+	  else
+	  { std::pair<DWORD,DWORD> &r = segrange[ls[i].seg];
+		if (ls[i].off<r.first) r.first=ls[i].off;
+		if (ls[i].off>r.second) r.second=ls[i].off;
+	  }
+	}
+  }
+  if (segrange.size()==0)
+	return; // no lines at all, so no subsection
+  //
+  PutW(sub,(WORD)files.size());
+  PutW(sub,(WORD)segrange.size());
+  size_t obasefile = sub->size();
+  for (size_t f=0; f<files.size(); f++)
+	PutD(sub,0);
+  std::map<WORD, std::pair<DWORD,DWORD> >::const_iterator g;
+  for (g=segrange.begin(); g!=segrange.end(); ++g)
+  { PutD(sub,g->second.first);
+	PutD(sub,g->second.second);
+  }
+  for (g=segrange.begin(); g!=segrange.end(); ++g)
+	PutW(sub,g->first);
+  PadD(sub);
+  //
+  for (size_t f=0; f<files.size(); f++)
+  {
+	const std::vector<TSrcLine> &ls = files[f]->lines;
+	const std::vector<TSrcRun> &rs = runs[f];
+	SetD(sub,obasefile+4*f,(DWORD)sub->size());
+	PutW(sub,(WORD)rs.size());
+	PutW(sub,0);
+	size_t obaseln = sub->size();
+	for (size_t r=0; r<rs.size(); r++)
+	  PutD(sub,0);
+	for (size_t r=0; r<rs.size(); r++)
+	{ PutD(sub,ls[rs[r].from].off);
+	  PutD(sub,ls[rs[r].from+rs[r].n-1].off);
+	}
+	PutName(sub,names,files[f]->name);
+	PadD(sub);
+	for (size_t r=0; r<rs.size(); r++)
+	{
+	  SetD(sub,obaseln+4*r,(DWORD)sub->size());
+	  PutW(sub,ls[rs[r].from].seg);
+	  PutW(sub,(WORD)rs[r].n);
+	  for (size_t i=0; i<rs[r].n; i++)
+		PutD(sub,ls[rs[r].from+i].off);
+	  for (size_t i=0; i<rs[r].n; i++)
+		PutW(sub,ls[rs[r].from+i].line);
+	  PadD(sub);
+	}
+  }
+}
+
+
+// BuildSstModule -- OMFModule, then the module's OMFSegDescs, then its name,
+// length-prefixed and padded to 4 bytes.
+void BuildSstModule(const TDbgModule &mod,const TNameArena &names,std::vector<char> *sub)
+{
+  OMFModule omfmodule;
+  omfmodule.ovlNumber = 0;
+  omfmodule.iLib = 0;
+  omfmodule.cSeg = (unsigned short)mod.segs.size();
+  omfmodule.Style[0] = 'C';
+  omfmodule.Style[1] = 'V';
+  sub->assign((char*)&omfmodule,(char*)&omfmodule+offsetof(OMFModule,SegInfo));
+  if (mod.segs.size()>0)
+	sub->insert(sub->end(),(char*)&mod.segs[0],(char*)(&mod.segs[0]+mod.segs.size()));
+  PutName(sub,names,mod.name);
+  PadD(sub);
+}
+
+
+bool TDebugFile::End()
+{
+  if (isended)
+	return endres;
+  isended=true;
+  endres=false;
+  if (!EnsureStarted() || err!="")
+	return false; // nb. a symbol that didn't fit leaves err set
+  int numsecs = image.NumberOfSections; // EnsureStarted checked it fits
+  // each module covers its ranges, in address order. As sections, two
+  // segments can share one (DATA and BSS share .data), and the last range of
+  // the first can run into the second's, so they're sorted and trimmed again.
+  std::vector<TModRange> secranges;
+  secranges.reserve(modranges.size());
+  for (size_t i=0; i<modranges.size(); i++)
+  { TModRange r = modranges[i];
+	DWORD secoff;
+	ToSection(modranges[i].seg,modranges[i].off,&r.seg,&secoff);
+	r.off = secoff;
+	if (r.seg!=0)
+	  secranges.push_back(r);
+  }
+  SortRanges(&secranges);
+  for (size_t i=0; i<secranges.size(); i++)
+  { const TModRange &r = secranges[i];
+	std::vector<OMFSegDesc> &segs = modules[r.imod].segs;
+	if (r.len==0)
+	  continue;
+	if (segs.size()>0 && segs.back().Seg==r.seg && segs.back().Off+segs.back().cbSeg==r.off)
+	  segs.back().cbSeg += r.len; // carries straight on from the last one
+	else
+	{ OMFSegDesc sd;
+	  sd.Seg   = r.seg;
+	  sd.pad   = 0;
+	  sd.Off   = r.off;
+	  sd.cbSeg = r.len;
+	  segs.push_back(sd);
+	}
+  }
+  if (modules.size()==0)
+  { // no detailed map, so one module for the lot
+	modules.push_back(TDbgModule());
+	modules[0].name = names.Intern(modname.c_str(),modname.Length());
+	for (int i=0; i<numsecs; i++)
+	{ OMFSegDesc sd;
+	  sd.Seg   = (unsigned short)(i+1);
+	  sd.pad   = 0;
+	  sd.Off   = 0;
+	  sd.cbSeg = image.Sections[i].Misc.VirtualSize;
+	  modules[0].segs.push_back(sd);
+	}
+  }
+  unsigned long nmod = (unsigned long)modules.size();
+  if (nmod>=0xFFFF)
+	{err="Too many modules in the map of '"+fnexe+"'";
+	 return false;} // iMod is an 'unsigned short', and 0xFFFF means global
+  std::vector< std::vector<TSrcFile*> > modfiles(nmod);
+  for (size_t f=0; f<srcfiles.size(); f++)
+  { // AddLines needed the map's addresses to find the module
+	std::vector<TSrcLine> &ls = srcfiles[f].lines;
+	size_t n=0;
+	for (size_t i=0; i<ls.size(); i++)
+	{ WORD sec;
+	  DWORD secoff;
+	  ToSection(ls[i].seg,ls[i].off,&sec,&secoff);
+	  if (sec==0)
+		continue;
+	  ls[n] = ls[i];
+	  ls[n].seg = sec;
+	  ls[n].off = secoff;
+	  n++;
+	}
+	ls.resize(n);
+	modfiles[srcfiles[f].imod].push_back(&srcfiles[f]);
+  }
+  for (unsigned long m=0; m<nmod; m++)
+	if (modules[m].segs.size()>0xFFFF || modfiles[m].size()>0xFFFF)
+	  {err="Too many segments or source files in module '"+AnsiString(names.Str(modules[m].name).c_str())+"'";
+	   return false;} // OMFModule and OMFSourceModule count them in an 'unsigned short'
+  std::vector<char> namehash;
+  BuildNameHash(pubs,&namehash);
+  unsigned long cbHSym    = (unsigned long)namehash.size();
+  std::vector<char> addrhash;
+  BuildAddrHash(pubs,numsecs,&addrhash);
+  unsigned long cbHAddr   = (unsigned long)addrhash.size();
+  std::vector<char> gnamehash, gaddrhash; // sstGlobalSym's own
+  if (globals.size()>0)
+  { BuildNameHash(globals,&gnamehash);
+	BuildAddrHash(globals,numsecs,&gaddrhash);
+  }
+  std::vector< std::vector<char> > sstmodule(nmod), srcmodule(nmod);
+  for (unsigned long m=0; m<nmod; m++)
+  { BuildSstModule(modules[m],names,&sstmodule[m]);
+	BuildSrcModule(modfiles[m],names,&srcmodule[m]);
+  }
+  //
+  ULONGLONG szGlobalPub  = gpoSym + cbHSym + cbHAddr;
+  ULONGLONG cvoSstModule = Align4(cvoGlobalPub + szGlobalPub);
+  std::vector<ULONGLONG> cvoMod(nmod), cvoSrc(nmod);
+  ULONGLONG cvo = cvoSstModule;
+  for (unsigned long m=0; m<nmod; m++)
+  { cvoMod[m] = cvo;
+	cvo = Align4(cvo + sstmodule[m].size());
+  }
+  ULONGLONG cvoSrcModule = cvo;
+  unsigned long nsrc = 0;
+  for (unsigned long m=0; m<nmod; m++)
+  { cvoSrc[m] = cvo;
+	cvo = Align4(cvo + srcmodule[m].size());
+	if (srcmodule[m].size()>0)
+	  nsrc++;
+  }
+  ULONGLONG cvoGlobalSym = cvo;
+  ULONGLONG szGlobalSym  = (globals.size()==0) ? 0 : sizeof(OMFSymHash) + globalsyms.size() + gnamehash.size() + gaddrhash.size();
+  cvo = Align4(cvoGlobalSym + szGlobalSym);
+  if (naliases>0)
+  { memcpy(&aliastable[0],&naliases,sizeof(DWORD));
+	PadD(&aliastable);
+  }
+  ULONGLONG cvoAliases   = cvo;
+  ULONGLONG szAliases    = aliastable.size();
+  ULONGLONG cvoSegMap    = Align4(cvoAliases + szAliases);
+  ULONGLONG szSegMap     = sizeof(OMFSegMap) + numsecs*sizeof(OMFSegMapDesc);
+  ULONGLONG cvoDir       = Align4(cvoSegMap + szSegMap);
+  unsigned long cDir     = nmod + nsrc + (szGlobalSym>0 ? 1 : 0) + (szAliases>0 ? 3 : 2);
+  ULONGLONG szCv         = cvoDir + sizeof(OMFDirHeader) + cDir*sizeof(OMFDirEntry);
+  if (oCv + szCv > MaxDbgSize)
+	{err="The debug information would take "+MBText(oCv+szCv)+", and the .dbg format can't address more than 2 GB: "
+		+"symbols "+MBText(gpoSym)+", their hash tables "+MBText(cbHSym+cbHAddr)
+		+", modules "+MBText(cvoSrcModule-cvoSstModule)+", line numbers "+MBText(cvoGlobalSym-cvoSrcModule)
+		+", procedures and data symbols "+MBText(szGlobalSym)+", aliases "+MBText(szAliases);
+	 return false;}
+
+  if (inmemory)
+	arena.resize((size_t)(oCv + szCv)); // the symbols are already in place
+  Seek(0);
   //
   // WriteDBGHeader
   IMAGE_SEPARATE_DEBUG_HEADER isdh;
+  memset(&isdh,0,sizeof(isdh)); // Reserved too
   isdh.Signature = IMAGE_SEPARATE_DEBUG_SIGNATURE;
   isdh.Flags = 0;
-  isdh.Machine            = image.FileHeader->FileHeader.Machine;
-  isdh.Characteristics    = image.FileHeader->FileHeader.Characteristics;
-  isdh.TimeDateStamp      = image.FileHeader->FileHeader.TimeDateStamp;
-  isdh.CheckSum           = image.FileHeader->OptionalHeader.CheckSum;
-  isdh.ImageBase          = image.FileHeader->OptionalHeader.ImageBase;
-  isdh.SizeOfImage        = image.FileHeader->OptionalHeader.SizeOfImage;
+  isdh.Machine            = image.FileHeader->Machine;
+  isdh.Characteristics    = image.FileHeader->Characteristics & ~IMAGE_FILE_DEBUG_STRIPPED; // as it was before convert marked it
+  isdh.TimeDateStamp      = image.FileHeader->TimeDateStamp;
+  isdh.CheckSum           = image.CheckSum();
+  isdh.ImageBase          = (DWORD)image.ImageBase(); // the .dbg header only has 32 bits for it
+  isdh.SizeOfImage        = image.SizeOfImage();
   isdh.NumberOfSections   = numsecs;
   isdh.ExportedNamesSize  = 0;
   isdh.DebugDirectorySize = 1*sizeof(IMAGE_DEBUG_DIRECTORY);
-  isdh.SectionAlignment   = image.FileHeader->OptionalHeader.SectionAlignment;
-  fwrite( &isdh,sizeof(isdh),1,file);
+  isdh.SectionAlignment   = image.SectionAlignment();
+  Put( &isdh, sizeof(isdh) );
   //
   // WriteSectionTable
   check(sizeof(IMAGE_SEPARATE_DEBUG_HEADER),"Section table");
-  fwrite(image.Sections, sizeof(IMAGE_SECTION_HEADER), numsecs, file);
+  Put( image.Sections, numsecs*sizeof(IMAGE_SECTION_HEADER) );
   //
   // WriteDbgDirectory
   check(sizeof(IMAGE_SEPARATE_DEBUG_HEADER) + numsecs*sizeof(IMAGE_SECTION_HEADER),"Debug directory");
   IMAGE_DEBUG_DIRECTORY idd;
   idd.Characteristics = 0;
-  idd.TimeDateStamp = image.FileHeader->FileHeader.TimeDateStamp;
+  idd.TimeDateStamp = image.FileHeader->TimeDateStamp;
   idd.MajorVersion = 0;
   idd.MinorVersion = 0;
   idd.Type = IMAGE_DEBUG_TYPE_CODEVIEW;
-  idd.SizeOfData = szCv;
+  idd.SizeOfData = (DWORD)szCv;
   idd.AddressOfRawData = 0;
-  idd.PointerToRawData = oCv;
-  fwrite( &idd, sizeof(idd), 1, file );
+  idd.PointerToRawData = (DWORD)oCv;
+  Put( &idd, sizeof(idd) );
   //
   // WriteCV - misc
   check(oCv, "CV data");
-  OMFSignature omfsig = { {'N','B','0','9'}, sizeof(omfsig) };
-  fwrite( &omfsig, sizeof(omfsig), 1, file );
-  // WriteCV - misc - dirheader
-  OMFDirHeader omfdirhdr;
-  omfdirhdr.cbDirHeader = sizeof(omfdirhdr);
-  omfdirhdr.cbDirEntry = sizeof(OMFDirEntry);
-  omfdirhdr.cDir = 3;
-  omfdirhdr.lfoNextDir = 0;
-  omfdirhdr.flags = 0;
-  fwrite( &omfdirhdr, sizeof(omfdirhdr), 1, file );
-  // WriteCV - misc - direntry[0]: sstModule
-  OMFDirEntry omfdirentry;
-  omfdirentry.SubSection = sstModule;
-  omfdirentry.iMod = 1;
-  omfdirentry.lfo = cvoSstModule;
-  omfdirentry.cb = szSstModule;
-  fwrite( &omfdirentry, sizeof(omfdirentry), 1, file );
-  // WriteCV - misc - direntry[1]: sstGlobalPub
-  omfdirentry.SubSection = sstGlobalPub;
-  omfdirentry.iMod = 0xFFFF;
-  omfdirentry.lfo = cvoGlobalPub;
-  omfdirentry.cb = gpoSym;
-  fwrite( &omfdirentry, sizeof(omfdirentry), 1, file );
-  // WriteCV - misc - direntry[2]: sstSegMap
-  omfdirentry.SubSection = sstSegMap;
-  omfdirentry.iMod = 0xFFFF;
-  omfdirentry.lfo = cvoSegMap;
-  omfdirentry.cb = szSegMap;
-  fwrite( &omfdirentry, sizeof(omfdirentry), 1, file );
+  OMFSignature omfsig = { {'N','B','0','9'}, (int)cvoDir };
+  Put( &omfsig, sizeof(omfsig) );
   //
-  // WriteSstModule
-  check(oCv + cvoSstModule, "CV:SST module");
-  OMFModule omfmodule;
-  omfmodule.ovlNumber = 0;
-  omfmodule.iLib = 0;
-  omfmodule.cSeg = (unsigned short)numsecs;
-  omfmodule.Style[0] = 'C';
-  omfmodule.Style[1] = 'V';
-  fwrite( &omfmodule, offsetof(OMFModule,SegInfo), 1, file );
-  // WriteSstModule - numsecs*OMFSegDesc
-  for (int i = 0; i < numsecs; i++ )
-  { OMFSegDesc omfsegdesc;
-	omfsegdesc.Seg = (unsigned short)(i+1);
-	omfsegdesc.pad = 0;
-	omfsegdesc.Off = 0;
-	omfsegdesc.cbSeg = image.Sections[i].Misc.VirtualSize;
-	fwrite( &omfsegdesc, sizeof(omfsegdesc), 1, file );
-  }
-  // WriteSstModule - modname
-
-  unsigned char namelen = modname.Length();
-  fwrite( &namelen, 1, 1, file ); // write the length byte
-  fwrite( modname.c_str(), namelen, 1, file ); // write the string
-  // write the padding bytes (if szModName is longer than namelen+1)
-  unsigned char pad = 0;
-  for (unsigned int i = 0; i < szModName - (namelen+1); i++ )
-	 fwrite( &pad, 1, 1, file );
   // WriteGlobalPub
   check(oCv + cvoGlobalPub,"CV:GlobalPub module");
   OMFSymHash omfSymHash;
-  omfSymHash.cbSymbol = gpoSym - sizeof(OMFSymHash);
-  omfSymHash.symhash = 0; // No symbol or address hash tables...
-  omfSymHash.addrhash = 0;
-  omfSymHash.cbHSym = 0;
-  omfSymHash.cbHAddr = 0;
-  fwrite( &omfSymHash, sizeof(omfSymHash), 1, file );
-
-  // WriteGlobal - symbols
-  fseek(file, oCv + cvoSegMap, SEEK_SET);
+  omfSymHash.cbSymbol = (DWORD)(gpoSym - sizeof(OMFSymHash));
+  omfSymHash.symhash = OMFHASH_SUMUC32;
+  omfSymHash.addrhash = OMFHASH_ADDR32;
+  omfSymHash.cbHSym = cbHSym;
+  omfSymHash.cbHAddr = cbHAddr;
+  Put( &omfSymHash, sizeof(omfSymHash) );
+
+  // WriteGlobal - symbols are already there
+  Seek(oCv + cvoGlobalPub + gpoSym);
+  //
+  // WriteNameHash
+  Put( &namehash[0], cbHSym );
+  //
+  // WriteAddrHash
+  Put( &addrhash[0], cbHAddr );
+  //
+  // WriteSstModule
+  PadTo(oCv + cvoSstModule);
+  for (unsigned long m=0; m<nmod; m++)
+  { PadTo(oCv + cvoMod[m]);
+	check(oCv + cvoMod[m], "CV:SST module");
+	Put( &sstmodule[m][0], sstmodule[m].size() );
+  }
+  //
+  // WriteSrcModule
+  PadTo(oCv + cvoSrcModule);
+  for (unsigned long m=0; m<nmod; m++)
+	if (srcmodule[m].size()>0)
+	{ PadTo(oCv + cvoSrc[m]);
+	  check(oCv + cvoSrc[m],"CV:SrcModule module");
+	  Put( &srcmodule[m][0], srcmodule[m].size() );
+	}
+  //
+  // WriteGlobalSym - the procedures, with their lengths filled in
+  PadTo(oCv + cvoGlobalSym);
+  if (szGlobalSym>0)
+  { check(oCv + cvoGlobalSym,"CV:GlobalSym module");
+	std::vector<DWORD> proclens;
+	ProcLengths(procs,segs,&proclens);
+	for (size_t k=0; k<procs.size(); k++)
+	  ((PROCSYM32*)&globalsyms[procs[k].recoff])->len = proclens[k];
+	OMFSymHash omfGlobalHash;
+	omfGlobalHash.cbSymbol = (DWORD)globalsyms.size();
+	omfGlobalHash.symhash = OMFHASH_SUMUC32;
+	omfGlobalHash.addrhash = OMFHASH_ADDR32;
+	omfGlobalHash.cbHSym = (DWORD)gnamehash.size();
+	omfGlobalHash.cbHAddr = (DWORD)gaddrhash.size();
+	Put( &omfGlobalHash, sizeof(omfGlobalHash) );
+	Put( &globalsyms[0], globalsyms.size() );
+	Put( &gnamehash[0], gnamehash.size() );
+	Put( &gaddrhash[0], gaddrhash.size() );
+  }
+  //
+  // WriteAliases
+  PadTo(oCv + cvoAliases);
+  check(oCv + cvoAliases,"CV:Aliases");
+  if (szAliases>0)
+	Put( &aliastable[0], szAliases );
   //
   // WriteSegMap
+  PadTo(oCv + cvoSegMap);
   check(oCv + cvoSegMap,"CV:SegMap module");
-  OMFSegMap omfSegMap = {(unsigned short)numsecs,(unsigned short)numsecs};
-  fwrite( &omfSegMap, sizeof(OMFSegMap), 1, file );
+  OMFSegMap omfSegMap;
+  memset(&omfSegMap,0,sizeof(omfSegMap));
+  omfSegMap.cSeg = (unsigned short)numsecs;
+  omfSegMap.cSegLog = (unsigned short)numsecs;
+  Put( &omfSegMap, sizeof(OMFSegMap) );
   // WriteSegMap - nsec*OMFSegMapDesc
   for (int i = 1; i <= numsecs; i++ )
   { OMFSegMapDesc omfSegMapDesc;
@@ -356,17 +1230,117 @@ bool TDebugFile::End()
 	omfSegMapDesc.iClassName = 0xFFFF;
 	omfSegMapDesc.offset = 0;
 	omfSegMapDesc.cbSeg = image.Sections[i-1].Misc.VirtualSize;
-	fwrite( &omfSegMapDesc, sizeof(OMFSegMapDesc), 1, file );
+	Put( &omfSegMapDesc, sizeof(OMFSegMapDesc) );
   }
   //
+  // WriteDirectory
+  PadTo(oCv + cvoDir);
+  check(oCv + cvoDir,"CV:directory");
+  OMFDirHeader omfdirhdr;
+  omfdirhdr.cbDirHeader = sizeof(omfdirhdr);
+  omfdirhdr.cbDirEntry = sizeof(OMFDirEntry);
+  omfdirhdr.cDir = cDir;
+  omfdirhdr.lfoNextDir = 0;
+  omfdirhdr.flags = 0;
+  Put( &omfdirhdr, sizeof(omfdirhdr) );
+  // WriteDirectory - sstModules, which have to come first
+  OMFDirEntry omfdirentry;
+  for (unsigned long m=0; m<nmod; m++)
+  { omfdirentry.SubSection = sstModule;
+	omfdirentry.iMod = (unsigned short)(m+1);
+	omfdirentry.lfo = (int)cvoMod[m];
+	omfdirentry.cb = (unsigned long)sstmodule[m].size();
+	Put( &omfdirentry, sizeof(omfdirentry) );
+  }
+  // WriteDirectory - sstSrcModules, in module order
+  for (unsigned long m=0; m<nmod; m++)
+	if (srcmodule[m].size()>0)
+	{ omfdirentry.SubSection = sstSrcModule;
+	  omfdirentry.iMod = (unsigned short)(m+1);
+	  omfdirentry.lfo = (int)cvoSrc[m];
+	  omfdirentry.cb = (unsigned long)srcmodule[m].size();
+	  Put( &omfdirentry, sizeof(omfdirentry) );
+	}
+  // WriteDirectory - sstGlobalPub
+  omfdirentry.SubSection = sstGlobalPub;
+  omfdirentry.iMod = 0xFFFF;
+  omfdirentry.lfo = (int)cvoGlobalPub;
+  omfdirentry.cb = (DWORD)szGlobalPub;
+  Put( &omfdirentry, sizeof(omfdirentry) );
+  // WriteDirectory - sstGlobalSym
+  if (szGlobalSym>0)
+  { omfdirentry.SubSection = sstGlobalSym;
+	omfdirentry.iMod = 0xFFFF;
+	omfdirentry.lfo = (int)cvoGlobalSym;
+	omfdirentry.cb = (DWORD)szGlobalSym;
+	Put( &omfdirentry, sizeof(omfdirentry) );
+  }
+  // WriteDirectory - sstAliases
+  if (szAliases>0)
+  { omfdirentry.SubSection = sstAliases;
+	omfdirentry.iMod = 0xFFFF;
+	omfdirentry.lfo = (int)cvoAliases;
+	omfdirentry.cb = (DWORD)szAliases;
+	Put( &omfdirentry, sizeof(omfdirentry) );
+  }
+  // WriteDirectory - sstSegMap
+  omfdirentry.SubSection = sstSegMap;
+  omfdirentry.iMod = 0xFFFF;
+  omfdirentry.lfo = (int)cvoSegMap;
+  omfdirentry.cb = (DWORD)szSegMap;
+  Put( &omfdirentry, sizeof(omfdirentry) );
+  //
   check(oCv + szCv,"CV:end");
-  return (err == "");
+  //
+  // WriteArena
+  if (inmemory && err=="")
+  {
+	if (skipsame)
+	{ TMappedFile old;
+	  unchanged = old.Open(fndbg.c_str()) && old.size==arena.size() && memcmp(old.base,&arena[0],arena.size())==0;
+	}
+	if (!unchanged)
+	{ file = fopen(fntmp.c_str(),"wb");
+	  if (file==NULL)
+		err="Failed to open output file "+fndbg;
+	  else if (fwrite(&arena[0],arena.size(),1,file)!=1)
+		err="Failed to write output file "+fndbg;
+	}
+  }
+  //
+  // and only now does it take the place of the old .dbg, if there is one
+  if (file!=NULL)
+  { if (fclose(file)!=0 && err=="")
+	  err="Failed to write output file "+fndbg; // e.g. the disk filled up
+	file=NULL;
+	if (err=="")
+	{ remove(fndbg.c_str());
+	  if (rename(fntmp.c_str(),fndbg.c_str())!=0)
+		err="Failed to replace "+fndbg;
+	}
+  }
+  endres = (err == "");
+  return endres;
+}
+
+void TDebugFile::Abort()
+{
+  if (!isended)
+  { isended=true;
+	endres=false;
+  }
+  arena.clear();
+  if (file!=NULL)
+	fclose(file);
+  file=NULL;
+  remove(fntmp.c_str()); // the existing .dbg, if any, is left as it was
 }
 
 
 //============================================================================
 // TMapFile -- for reading a .map file
-// methods GetSymbol(seg,off,name)
+// methods GetSymbol(seg,off,name,namelen), GetLineBlock(block), and the
+// 'segments' and 'contribs' it found on the way to the publics
 //============================================================================
 // File format: It's a plain text file
 // It must be generated with from BCB with 'publics' or 'detailed'.
@@ -377,117 +1351,634 @@ bool TDebugFile::End()
 // If we discover any @ symbols in the function names, that's probably because
 // show-mangled-names was turned on
 //
+// The file is mapped into memory rather than loaded line by line: maps of
+// big projects run to hundreds of MB, and a TStringList would allocate a heap
+// string for every one of those lines. Instead we walk the mapped bytes and
+// hand out (pointer,length) views of them. Names returned by GetSymbol point
+// straight into the mapping, so they are only valid while the TMapFile lives.
+// GetSymbols, which collects millions of them, keeps each name as a TNameRef
+// into the mapping instead: 16 bytes a symbol rather than 32 on 64-bit
+// builds. Name(ref) turns one back into a pointer.
+//
+// The whole file is read in one forward pass: the constructor walks up to
+// and past the publics header, and GetSymbol carries on from there. Mangling
+// is classified on the way, from whichever lines that pass visits. 'stats'
+// records how much of the file the pass has touched.
+//
+// Once the header has been found, the remaining lines are independent of each
+// other, so GetSymbols can also split them into newline-aligned chunks and
+// parse those on several threads. The result is the same list, in the same
+// order, that repeated calls to GetSymbol would have given: each chunk stops
+// at its first line that isn't a public, and chunks after the first one that
+// stopped are discarded.
+//
+// On the way to the publics, the constructor also picks up the segment table
+// at the top, into 'segments', e.g.
+//   " 0001:00401000 00008319CH _TEXT                  CODE"
+// and the "Detailed map of segments", if there is one: a line for each
+// module's contribution to each segment, such as
+//   " 0001:0000115C 00003821 C=CODE S=_TEXT G=(none) M=C:\APP\CALLSTACK.OBJ ACBP=A9"
+// These go in 'contribs', in the order listed.
+//
+// Maps generated with 'detailed' also have line numbers, after the publics,
+// in blocks like
+//   "Line numbers for Unit1(Unit1.pas) segment .text", "", then lines of
+//   "    28 0001:0000A3F0    29 0001:0000A3F5    30 0001:0000A400" ...
+// i.e. pairs of a line number and its address. GetLineBlock hands these out
+// a block at a time, once the publics are done with. The line that ended the
+// publics is left unread, since it's usually the first block's header.
+//
+// A map compressed with gzip or zstd (see mapstream.h) is read the same way,
+// except that the lines come from a window of decompressed text that slides
+// along as they're read, rather than from a mapping of the whole file. Only
+// the window, and whatever was picked out of the map, is ever in memory. So
+// in that case the names GetSymbol returns are only valid until the next
+// call; GetSymbols copies the names into an arena of its own, and Name(ref)
+// looks there; and the segment classes, module names and line block names
+// are copies too.
+//
+struct TMapSymbol
+{ WORD     seg;
+  DWORD    off;
+  TNameRef name; // in the mapped file; not nul-terminated
+};
+
+struct TMapSegment
+{ unsigned short seg;
+  unsigned long  start, len;
+  const char    *cls; // points into the mapped file
+  int            clslen;
+};
+
+struct TMapContrib
+{ unsigned short seg;
+  unsigned long  off, len;
+  const char    *module; // points into the mapped file
+  int            modulelen;
+};
+
+struct TMapLineBlock
+{ const char *unit; int unitlen; // point into the mapped file
+  const char *file; int filelen; // the source file, e.g. Unit1.pas
+  std::vector<TMapLine> lines;
+};
+
 class TMapFile
 { public:
   TMapFile(AnsiString fnmap);
-  ~TMapFile()
-  {
-	if (str!=NULL)
-	  delete str;
-	str=NULL;
-  }
-  bool GetSymbol(unsigned short *aseg,unsigned long *aoff,AnsiString *aname);
+  ~TMapFile() {delete stream;}
+  bool GetSymbol(unsigned short *aseg,unsigned long *aoff,const char **aname,int *anamelen);
+  void GetSymbols(std::vector<TMapSymbol> *syms,int threads); // all the remaining ones
+  const char *Name(TNameRef r) const {return (stream!=NULL) ? names.Ptr(r) : base+r.off;} // of one of those
+  const char *Names() const {return Name(TNameRef());}                                  // what those are relative to
+  bool GetLineBlock(TMapLineBlock *block); // the next one after the publics
   //
   bool isok;
   bool ismangled;
-  int line;
-  int num;
-  TStringList *str;
+  std::vector<TMapSegment> segments; // from the segment table
+  std::vector<TMapContrib> contribs; // from the detailed map of segments
+  TMapScanStats stats;
   AnsiString err;
+protected:
+  TMappedFile file;
+  const char *base; // the mapped view of the whole file, or the window onto it
+  const char *end;  // one past its last byte
+  const char *pos;  // start of the next line to be read
+  bool NextLine(const char **aline,int *alen); // line excludes its CR/LF
+  void UnreadLine(const char *line);            // steps back to the start of it
+  // for a compressed map
+  TMapStream *stream;
+  std::vector<char> window;    // holds [base,end)
+  unsigned long long dropped;  // bytes that have slid out of the window
+  bool streamend;              // the last of them is in the window
+  TNameArena names;            // names that GetSymbols picked out
+  std::deque<std::string> kept; // and the other strings
+  bool Fill();                              // a whole line, or the rest, from pos on
+  const char *Keep(const char *s,int len); // a copy of s that lasts, if s won't
 };
 
 
-TMapFile::TMapFile(AnsiString fnmap)
+TMapFile::TMapFile(AnsiString fnmap) : isok(false), ismangled(false), err(""), base(NULL), end(NULL), pos(NULL), stream(NULL), dropped(0), streamend(false)
 {
-  err="";
-  isok=false;
-  str=new TStringList();
-  try
+  memset(&stats,0,sizeof(stats));
+  if (!file.Open(fnmap.c_str())) // a zero-length file maps as base==NULL, but has no publics anyway
+  {
+	err=file.err.c_str();
+	return;
+  }
+  if (MapCompression(file.base,file.size)!=mcNone)
   {
-	str->LoadFromFile(fnmap);
+	std::string serr;
+	stream = OpenMapStream(file.base,file.size,serr);
+	if (stream==NULL)
+	{
+	  err=(serr+" - '").c_str()+fnmap+"'";
+	  return;
+	}
+	window.resize(1024*1024);
+	base = &window[0];
+	end = base;
+	pos = base;
   }
-  catch (Exception &e)
+  else
   {
-	err="Couldn't load file '"+fnmap+"' - "+e.ClassName()+" "+e.Message;
+	if (file.size>0xFFFFFFFFUL) // TNameRef offsets are 32 bits
+	{
+	  err="Map file is too big - '"+fnmap+"'";
+	  return;
+	}
+	base = file.base;
+	end = base+file.size;
+	pos = base;
   }
 
   //exact indexof does not work for new Delphi/CBuilder .map files (2007 & 2009)
   //line=str->IndexOf("  Address         Publics by Value");
 
-  String s;
-  for (int i=0; i < str->Count; i++)
+  const char *s; int len;
+  const char hdr[] = " Publics by Value";
+  const int hdrlen = sizeof(hdr)-1;
+  const char dhdr[] = "Detailed map of segments";
+  const int dhdrlen = sizeof(dhdr)-1;
+  bool indetail=false;
+  while (!isok && NextLine(&s,&len))
   {
-	s = str->Strings[i];
-	if (s.Pos(" Publics by Value") != 0)    //compatible with D2007, 2009 etc
-	{
-	  line = i;
-	  break;
+	if (!ismangled && memchr(s,'@',len)!=NULL)
+	  ismangled=true;
+	TSegmentLine sl;
+	if (!indetail && ParseSegmentLine(s,len,&sl))
+	{ TMapSegment g;
+	  g.seg    = sl.seg;
+	  g.start  = sl.start;
+	  g.len    = sl.len;
+	  g.cls    = Keep(s+sl.clspos,sl.clslen);
+	  g.clslen = sl.clslen;
+	  segments.push_back(g);
+	  continue;
 	}
+	TSegmentDetailLine dl;
+	if (indetail && ParseSegmentDetailLine(s,len,&dl))
+	{ TMapContrib c;
+	  c.seg       = dl.seg;
+	  c.off       = dl.off;
+	  c.len       = dl.len;
+	  c.module    = Keep(s+dl.modpos,dl.modlen);
+	  c.modulelen = dl.modlen;
+	  contribs.push_back(c);
+	  continue;
+	}
+	for (int i=0; i+dhdrlen<=len && !indetail; i++)
+	  indetail = (memcmp(s+i,dhdr,dhdrlen)==0);
+	for (int i=0; i+hdrlen<=len && !isok; i++)
+	  isok = (memcmp(s+i,hdr,hdrlen)==0);    //compatible with D2007, 2009 etc
   }
-  line++; // to skip past that header
-  isok = (line!=0);
+  // pos has now skipped past that header
 
-  if (line==0 && err!="")
+  if (!isok && err=="")
 	err="Map file doesn't list any publics - '"+fnmap+"'";
-  num=str->Count-line-1;
-  ismangled=false;
-  for (int i=0; line!=0 && !ismangled && i<str->Count; i++)
+  else if (err!="")
+	err=err+" - '"+fnmap+"'";
+}
+
+// SplitLine -- takes the line at *ppos (excluding its CR/LF), and advances
+// *ppos past it. Returns false at 'end'.
+static inline bool SplitLine(const char **ppos,const char *end,const char **aline,int *alen)
+{
+  const char *s=*ppos;
+  if (s==end)
+	return false;
+  const char *eol = (const char*)memchr(s,'\n',end-s);
+  if (eol==NULL)
+	eol=end;
+  *ppos = (eol==end) ? end : eol+1;
+  while (eol!=s && (eol[-1]=='\r' || eol[-1]=='\n')) eol--;
+  *aline=s;
+  *alen=(int)(eol-s);
+  return true;
+}
+
+// ParseSymbolLine -- the part of GetSymbol that deals with one non-empty line
+static inline bool ParseSymbolLine(const char *base,const char *s,int len,TMapSymbol *sym)
+{
+  TPublicLine pl;
+  if (!ParsePublicLine(s,len,&pl))
+	return false;
+  sym->seg      = pl.seg;
+  sym->off      = pl.off;
+  sym->name.off = (unsigned int)(s-base) + pl.namepos;
+  sym->name.len = pl.namelen;
+  return true;
+}
+
+bool TMapFile::NextLine(const char **aline,int *alen)
+{
+  if (stream!=NULL && !Fill())
+	return false;
+  if (!SplitLine(&pos,end,aline,alen))
+	return false;
+  stats.lines++;
+  stats.bytes = (unsigned long)(dropped+(pos-base));
+  return true;
+}
+
+void TMapFile::UnreadLine(const char *line)
+{
+  pos=line; // still in the window: it only slides in Fill, before a line is read
+  stats.lines--;
+  stats.bytes = (unsigned long)(dropped+(pos-base));
+}
+
+// Fill -- slides the window along, until it has the whole of the line at pos
+// in it (or the rest of the map, if that has no newline). Returns false, with
+// 'err' set, if the map can't be decompressed.
+bool TMapFile::Fill()
+{
+  while (!streamend && memchr(pos,'\n',end-pos)==NULL)
   {
-	String s = str->Strings[i];
-	if (s.Pos("@")!=0)
-	  ismangled=true;
+	size_t keep = end-pos;
+	dropped += pos-base;
+	memmove(&window[0],pos,keep);
+	if (window.size()-keep < window.size()/4)
+	  window.resize(window.size()*2); // a very long line
+	base = &window[0];
+	pos = base;
+	end = base+keep;
+	int n = stream->Read(&window[keep],(int)(window.size()-keep));
+	if (n<0)
+	{
+	  err=stream->err.c_str();
+	  return false;
+	}
+	if (n==0)
+	  streamend=true;
+	end += n;
   }
+  return true;
+}
+
+const char *TMapFile::Keep(const char *s,int len)
+{
+  if (stream==NULL)
+	return s; // it's in the mapping, which lasts
+  kept.push_back(std::string(s,len));
+  return kept.back().c_str();
 }
 
-bool TMapFile::GetSymbol(unsigned short *aseg,unsigned long *aoff,AnsiString *aname)
+bool TMapFile::GetSymbol(unsigned short *aseg,unsigned long *aoff,const char **aname,int *anamelen)
 {
-  if (line==0)
+  if (!isok)
 	return false;
   if (err!="")
 	return false;
-  while (line<str->Count && str->Strings[line]=="") line++;
-  if (line==str->Count)
-	return false;
-  AnsiString s = str->Strings[line];
+  const char *s; int len;
+  do
+  {
+	if (!NextLine(&s,&len))
+	  return false;
+  } while (len==0);
 
   //example of some lines:
   // 0001:0000035C       System.CloseHandle
   // 0001:00000380  __acrtused
 
-  line++;
-  if (s.Length()<15)          //minimal size = 15
+  TMapSymbol sym;
+  if (!ParseSymbolLine(base,s,len,&sym))
+  {
+	UnreadLine(s);
 	return false;
-  AnsiString sseg = s.SubString(2,4);
-  for (int i=1; i<=sseg.Length(); i++)
+  }
+  if (!ismangled && memchr(base+sym.name.off,'@',sym.name.len)!=NULL)
+	ismangled=true;
+  stats.symbols++;
+  *aseg  = sym.seg;
+  *aoff  = sym.off;
+  *aname = base+sym.name.off;
+  *anamelen = sym.name.len;
+  return true;
+}
+
+// TMapChunk -- one worker's share of the publics section
+struct TMapChunk
+{ const char *base;            // the mapped file, which names are relative to
+  const char *from, *to;       // whole lines of it
+  std::vector<TMapSymbol> syms;
+  bool stopped;                // hit a line that isn't a public
+  bool ismangled;
+  unsigned long lines;
+};
+
+static void ParseMapChunk(void *arg)
+{
+  TMapChunk *c = (TMapChunk*)arg;
+  const char *pos=c->from, *s; int len;
+  while (!c->stopped && SplitLine(&pos,c->to,&s,&len))
   {
-	char c = sseg[i];
-	bool okay = (c>='0' && c<='9') || (c>='A' && c<='F') || (c>='a' && c<='f');
-	if (!okay)
-	  return false;
+	c->lines++;
+	if (len==0)
+	  continue;
+	TMapSymbol sym;
+	if (!ParseSymbolLine(c->base,s,len,&sym))
+	{ c->stopped=true;
+	  c->lines--;
+	  pos=s; // leave that line for whoever reads on
+	}
+	else
+	{
+	  if (!c->ismangled && memchr(c->base+sym.name.off,'@',sym.name.len)!=NULL)
+		c->ismangled=true;
+	  c->syms.push_back(sym);
+	}
   }
-  AnsiString soff=s.SubString(7,8);
-  for (int i=1; i<soff.Length(); i++)
+  c->to=pos; // how far we actually got
+}
+
+void TMapFile::GetSymbols(std::vector<TMapSymbol> *syms,int threads)
+{
+  if (!isok || err!="")
+	return;
+  // Don't bother with threads for less than 256k per chunk.
+  const unsigned long minchunk = 256*1024;
+  unsigned long size = (unsigned long)(end-pos);
+  int nchunks = threads;
+  if ((unsigned long)nchunks > size/minchunk)
+	nchunks = (int)(size/minchunk);
+  if (nchunks<=1 || stream!=NULL) // a stream is decompressed serially anyway
   {
-	char c = soff[i];
-	bool okay = (c>='0' && c<='9') || (c>='A' && c<='F') || (c>='a' && c<='f');
-	if (!okay)
+	unsigned short seg; unsigned long off; const char *name; int namelen;
+	while (GetSymbol(&seg,&off,&name,&namelen))
+	{ TMapSymbol sym;
+	  sym.seg = seg;
+	  sym.off = off;
+	  if (stream!=NULL)
+		sym.name = names.Add(name,namelen);
+	  else
+	  { sym.name.off = (unsigned int)(name-base);
+		sym.name.len = namelen;
+	  }
+	  syms->push_back(sym);
+	}
+	return;
+  }
+  //
+  std::vector<TMapChunk> chunks(nchunks);
+  std::vector<void*> args(nchunks);
+  const char *from=pos;
+  for (int i=0; i<nchunks; i++)
+  {
+	const char *to = (i==nchunks-1) ? end : pos + (size/nchunks)*(i+1);
+	if (to<from)
+	  to=from;
+	if (to!=end)
+	{ // move the split to just after the next newline
+	  const char *eol = (const char*)memchr(to,'\n',end-to);
+	  to = (eol==NULL) ? end : eol+1;
+	}
+	chunks[i].base=base;
+	chunks[i].from=from;
+	chunks[i].to=to;
+	chunks[i].stopped=false;
+	chunks[i].ismangled=false;
+	chunks[i].lines=0;
+	args[i]=&chunks[i];
+	from=to;
+  }
+  RunWorkers(nchunks,ParseMapChunk,&args[0]);
+  //
+  for (int i=0; i<nchunks; i++)
+  {
+	syms->insert(syms->end(),chunks[i].syms.begin(),chunks[i].syms.end());
+	ismangled = ismangled || chunks[i].ismangled;
+	stats.symbols += (unsigned long)chunks[i].syms.size();
+	stats.lines += chunks[i].lines;
+	pos = chunks[i].to;
+	if (chunks[i].stopped)
+	  break;
+  }
+  stats.bytes = (unsigned long)(pos-base);
+}
+
+static inline int HexVal(char c)
+{
+  if (c>='0' && c<='9') return c-'0';
+  if (c>='A' && c<='F') return c-'A'+10;
+  if (c>='a' && c<='f') return c-'a'+10;
+  return -1;
+}
+
+// ParseLineNumbers -- the "    28 0001:0000A3F0    29 0001:0000A3F5" lines
+// of a line-number block. Returns false, having added nothing, unless the
+// whole line is such pairs.
+static bool ParseLineNumbers(const char *s,int len,std::vector<TMapLine> *lines)
+{
+  size_t n0 = lines->size();
+  int i=0;
+  for (;;)
+  {
+	while (i<len && (s[i]==' ' || s[i]=='\t')) i++;
+	if (i==len)
+	  break;
+	TMapLine ml;
+	ml.line=0;
+	int start=i;
+	while (i<len && s[i]>='0' && s[i]<='9')
+	  ml.line = ml.line*10 + (s[i++]-'0');
+	bool ok = (i>start && i<len && s[i]==' ');
+	while (ok && i<len && s[i]==' ') i++;
+	ok = ok && i+13<=len && s[i+4]==':' && (i+13==len || s[i+13]==' ' || s[i+13]=='\t');
+	unsigned long seg=0, off=0;
+	for (int k=0; ok && k<13; k++)
+	{ if (k==4)
+		continue;
+	  int d = HexVal(s[i+k]);
+	  if (d<0)
+		ok=false;
+	  else if (k<4)
+		seg = (seg<<4) | d;
+	  else
+		off = (off<<4) | d;
+	}
+	if (!ok)
+	{
+	  lines->resize(n0);
 	  return false;
+	}
+	ml.seg = (unsigned short)seg;
+	ml.off = off;
+	lines->push_back(ml);
+	i+=13;
   }
-  //AnsiString sname = Trim(s.SubString(21,s.Length()-20));
-  AnsiString sname = Trim(s.SubString(15,s.Length()));      //minimal size = 15
-  unsigned int val;
-  int i;
-  i = sscanf(sseg.c_str(),"%x",&val);
-  if (i!=1)
-	return false;
-  if (val>0xFFFF)
-	return false;
-  *aseg = (unsigned short)val;
-  i = sscanf(soff.c_str(),"%x",&val);
-  if (i!=1)
+  return lines->size()>n0;
+}
+
+bool TMapFile::GetLineBlock(TMapLineBlock *block)
+{
+  block->lines.clear();
+  if (!isok || err!="")
 	return false;
-  *aoff  = val;
-  *aname = sname;
+  const char hdr[] = "Line numbers for ";
+  const int hdrlen = sizeof(hdr)-1;
+  const char *s; int len;
+  do
+  {
+	if (!NextLine(&s,&len))
+	  return false;
+  } while (len<=hdrlen || memcmp(s,hdr,hdrlen)!=0);
+  //
+  // "Line numbers for unit(file) segment seg". The file is in the last
+  // brackets before " segment", since the unit may be a path with some in.
+  const char *u=s+hdrlen, *e=s+len;
+  const char sgm[] = " segment ";
+  const int sgmlen = sizeof(sgm)-1;
+  for (const char *c=e-sgmlen; c>=u; c--)
+	if (memcmp(c,sgm,sgmlen)==0)
+	  {e=c; break;}
+  const char *close=NULL, *open=NULL;
+  for (const char *c=e-1; c>=u && close==NULL; c--)
+	if (*c==')') close=c;
+  for (const char *c=(close==NULL)?NULL:close-1; c!=NULL && c>=u && open==NULL; c--)
+	if (*c=='(') open=c;
+  if (open!=NULL)
+  { block->unit=Keep(u,(int)(open-u));          block->unitlen=(int)(open-u);
+	block->file=Keep(open+1,(int)(close-open-1)); block->filelen=(int)(close-open-1);
+  }
+  else
+  { block->unit=Keep(u,(int)(e-u)); block->unitlen=(int)(e-u);
+	block->file=block->unit;        block->filelen=(int)(e-u);
+  }
+  //
+  while (NextLine(&s,&len))
+  {
+	if (len==0)
+	  continue;
+	if (!ParseLineNumbers(s,len,&block->lines))
+	{
+	  UnreadLine(s); // probably the next block's header
+	  break;
+	}
+  }
+  return true;
+}
+
+
+//============================================================================
+// Alias folding. The map often lists several names at one address, e.g.
+// "c1_0" and "__acrtused", or "Sysinit::__linkproc__ __fastcall GetTls()"
+// and "___System__GetTls". FoldAliases picks one of them, the primary, by
+// the preference given (see TAliasFold in convert.h), and lists the symbols
+// in the order they should be added: each primary where it came in the
+// map, followed by the other names at its address. The names can be
+// anywhere in the map, not just next to each other.
+//============================================================================
+//
+struct TFoldedSym
+{ size_t sym;  // index into the symbols
+  bool alias;  // an alias of the last primary before it
+};
+
+struct TMapSymAddrLess
+{ const std::vector<TMapSymbol> *syms;
+  bool operator()(size_t a,size_t b) const
+  { const TMapSymbol &sa=(*syms)[a], &sb=(*syms)[b];
+	if (sa.seg!=sb.seg) return sa.seg<sb.seg;
+	return sa.off<sb.off;
+  }
+};
+
+// AliasRank -- for afDemangled: the higher, the more readable
+static int AliasRank(const char *name,int len)
+{
+  if (len==0)
+	return 0;
+  if (name[0]=='@')
+	return 1; // mangled
+  for (int i=0; i<len; i++)
+	if (name[i]=='(' || (name[i]==':' && i+1<len && name[i+1]==':'))
+	  return 3; // demangled C++
+  // a compiler label: a letter or two, digits, '_', digits
+  int i=0;
+  while (i<len && name[i]>='a' && name[i]<='z') i++;
+  int d1=i;
+  while (i<len && name[i]>='0' && name[i]<='9') i++;
+  if (d1>0 && i>d1 && i<len && name[i]=='_')
+  { int d2=++i;
+	while (i<len && name[i]>='0' && name[i]<='9') i++;
+	if (i==len && i>d2)
+	  return 0;
+  }
+  return 2;
+}
+
+static bool AliasBetter(const TMapSymbol &a,const TMapSymbol &b,const char *names,TAliasFold how)
+{
+  if (how==afDemangled)
+	return AliasRank(names+a.name.off,a.name.len) > AliasRank(names+b.name.off,b.name.len);
+  if (how==afLongest)
+	return a.name.len > b.name.len;
+  return false; // afFirst
+}
+
+void FoldAliases(const std::vector<TMapSymbol> &syms,const char *names,TAliasFold how,std::vector<TFoldedSym> *out)
+{
+  out->clear();
+  std::vector<size_t> order;
+  order.reserve(syms.size());
+  for (size_t i=0; i<syms.size(); i++)
+	if (syms[i].name.len>0)                //skip empty names
+	  order.push_back(i);
+  TMapSymAddrLess less; less.syms=&syms;
+  std::stable_sort(order.begin(),order.end(),less);
+  // for each symbol, the group of names at its address, as a range of 'order'
+  std::vector<size_t> groupstart(syms.size()), groupend(syms.size()), primary(syms.size());
+  for (size_t g=0; g<order.size(); )
+  {
+	size_t e=g+1;
+	while (e<order.size() && !less(order[g],order[e]))
+	  e++;
+	size_t best=order[g];
+	for (size_t k=g+1; k<e; k++)
+	  if (AliasBetter(syms[order[k]],syms[best],names,how))
+		best=order[k];
+	for (size_t k=g; k<e; k++)
+	{ groupstart[order[k]]=g;
+	  groupend[order[k]]=e;
+	  primary[order[k]]=best;
+	}
+	g=e;
+  }
+  for (size_t i=0; i<syms.size(); i++)
+	if (syms[i].name.len>0 && primary[i]==i)
+	{
+	  TFoldedSym f;
+	  f.sym=i;
+	  f.alias=false;
+	  out->push_back(f);
+	  f.alias=true;
+	  for (size_t k=groupstart[i]; k<groupend[i]; k++)
+		if (order[k]!=i)
+		{ f.sym=order[k];
+		  out->push_back(f);
+		}
+	}
+}
+
+
+// MarkDebugStripped -- sets the exe's debug-stripped flag, unless it's set
+// already. The flag is patched in place, through a writable mapping of the
+// headers.
+static bool MarkDebugStripped(AnsiString exe,AnsiString &err)
+{
+  TPEImage pe;
+  if (!pe.Open(exe.c_str(),true))
+	{err="Unable to open '"+exe+"' to strip it of debugging information. "+AnsiString(pe.err.c_str());
+	 return false;}
+  bool already = ((pe.FileHeader->Characteristics & IMAGE_FILE_DEBUG_STRIPPED)!=0);
+  if (!already)
+  { pe.FileHeader->Characteristics |= IMAGE_FILE_DEBUG_STRIPPED;
+	if (!pe.Flush())
+	  {err="Unable to mark '"+exe+"' as debug-stripped. "+AnsiString(pe.err.c_str());
+	   return false;}
+  }
+  pe.Close();
   return true;
 }
 
@@ -498,69 +1989,160 @@ bool TMapFile::GetSymbol(unsigned short *aseg,unsigned long *aoff,AnsiString *an
 // to bother reading the map or writing the dbg, but merely mark the executable.
 //============================================================================
 //
-int convert(AnsiString exe,AnsiString &err)
+int convert(AnsiString exe,AnsiString &err,const TConvertOptions *opts,TMapScanStats *stats,TConvertTimes *times)
 {
-  iinit();
-  if (!issucc)
-	{err="imagehlp.dll could not be loaded";
-	 return 0;}
-  //
+  TConvertOptions defopts;
+  if (opts==NULL)
+	opts=&defopts;
+  if (times!=NULL)
+	memset(times,0,sizeof(*times));
   if (!FileExists(exe))
 	{err="File '"+exe+"' does not exist.";
 	 return 0;}
   AnsiString dbg = ChangeFileExt(exe,".dbg");
   AnsiString map = ChangeFileExt(exe,".map");
+  if (!FileExists(map) && FileExists(map+".gz"))
+	map=map+".gz";
+  else if (!FileExists(map) && FileExists(map+".zst"))
+	map=map+".zst";
   if (!FileExists(map))
 	{err="Need the map file '"+map+"' to get symbols.";
 	 return 0;}
+  // With the cache, a .dbg made from this same map and image is reused, with
+  // just the exe's timestamp and checksum patched into it. A key that can't
+  // be made (say, the exe isn't a PE image) only means a full conversion, and
+  // that will report the problem properly.
+  AnsiString fncache = ChangeFileExt(exe,".m2dcache");
+  TDbgCacheKey key;
+  bool keyed=false;
+  if (opts->cache)
+  { TPEImage pe;
+	std::string kerr;
+	if (pe.Open(exe.c_str()))
+	  keyed = MakeDbgCacheKey(pe,map.c_str(),*opts,&key,kerr);
+	pe.Close();
+	TDbgCacheKey cached;
+	if (keyed && ReadDbgCache(fncache.c_str(),&cached) && UseDbgCache(dbg.c_str(),cached,key))
+	{ if (!MarkDebugStripped(exe,err))
+		return 0;
+	  key.dbgsize = cached.dbgsize;
+	  key.num     = cached.num;
+	  if (cached.timestamp!=key.timestamp || cached.checksum!=key.checksum)
+		WriteDbgCache(fncache.c_str(),key);
+	  if (stats!=NULL)
+		memset(stats,0,sizeof(*stats));
+	  err="";
+	  return key.num;
+	}
+  }
+  // any cache file there is about to describe the wrong .dbg
+  if (FileExists(fncache))
+	remove(fncache.c_str());
   //
+  double t0 = WallClock();
   TMapFile *mf = new TMapFile(map);
-  int num=mf->num;
-  TDebugFile *df = new TDebugFile(exe,dbg);
+  if (mf->err!="")
+	{err=mf->err;
+	 delete mf;
+	 return 0;}
+  int num=0;
+  TDebugFile *df = new TDebugFile(exe,dbg,opts->inmemory,opts->skipsame);
+  for (size_t i=0; i<mf->segments.size(); i++)
+	df->AddSegment(mf->segments[i].seg,mf->segments[i].start,mf->segments[i].len,mf->segments[i].cls,mf->segments[i].clslen);
+  for (size_t i=0; i<mf->contribs.size(); i++)
+	df->AddModule(mf->contribs[i].module,mf->contribs[i].modulelen,mf->contribs[i].seg,mf->contribs[i].off,mf->contribs[i].len);
   bool anymore=true;
+  if (opts->aliases!=afKeepAll)
+  { // all the publics are needed before any can be added, to fold them
+	std::vector<TMapSymbol> syms;
+	mf->GetSymbols(&syms, opts->threads<=0 ? NumberOfCores() : opts->threads);
+	double t1 = WallClock();
+	std::vector<TFoldedSym> folded;
+	FoldAliases(syms,mf->Names(),opts->aliases,&folded);
+	for (size_t i=0; anymore && i<folded.size(); i++)
+	{ const TMapSymbol &sym = syms[folded[i].sym];
+	  if (!folded[i].alias)
+	  { anymore=df->AddSymbol(sym.seg,sym.off,mf->Name(sym.name),sym.name.len);
+		if (anymore)
+		  num++;
+	  }
+	  else if (opts->aliastable)
+		anymore=df->AddAlias(mf->Name(sym.name),sym.name.len);
+	}
+	anymore=false;
+	if (times!=NULL)
+	{ times->map = t1-t0;
+	  times->add = WallClock()-t1;
+	}
+  }
+  else if (opts->threads!=1 || times!=NULL)
+  { // parse the publics on several threads, then add them in the usual order
+	std::vector<TMapSymbol> syms;
+	mf->GetSymbols(&syms, opts->threads<=0 ? NumberOfCores() : opts->threads);
+	double t1 = WallClock();
+	for (size_t i=0; anymore && i<syms.size(); i++)
+	  if (syms[i].name.len>0)                //skip empty names
+	  { anymore=df->AddSymbol(syms[i].seg,syms[i].off,mf->Name(syms[i].name),syms[i].name.len);
+	    if (anymore)
+	      num++;
+	  }
+	anymore=false;
+	if (times!=NULL)
+	{ times->map = t1-t0;
+	  times->add = WallClock()-t1;
+	}
+  }
   while (anymore)
   { unsigned short seg;
 	unsigned long off;
-	AnsiString name;
-	anymore=mf->GetSymbol(&seg,&off,&name);
+	const char *name;
+	int namelen;
+	anymore=mf->GetSymbol(&seg,&off,&name,&namelen);
 	if (anymore)
-	  if (name.Length()>0)                   //skip empty names
-	    anymore=df->AddSymbol(seg,off,name); // stop it upon error
+	  if (namelen>0)                         //skip empty names
+	  { anymore=df->AddSymbol(seg,off,name,namelen); // stop it upon error
+	    if (anymore)
+	      num++;
+	  }
   }
+  // then the line numbers, if the map has any
+  double t3 = WallClock();
+  TMapLineBlock block;
+  while (mf->GetLineBlock(&block))
+	if (block.lines.size()>0)
+	  df->AddLines(block.file,block.filelen,&block.lines[0],(int)block.lines.size());
+  if (times!=NULL)
+	times->map += WallClock()-t3;
+  if (stats!=NULL)
+	*stats=mf->stats;
+  AnsiString merr=mf->err; // a compressed map can turn out to be damaged part way through
   delete mf;
+  if (merr!="")
+	{df->Abort(); // rather than leave one with only some of the symbols
+	 delete df;
+	 err=merr+" - '"+map+"'";
+	 return 0;}
+  double t2 = WallClock();
   bool dres=df->End();
+  if (times!=NULL)
+	times->end = WallClock()-t2;
   AnsiString derr=df->err;
   delete df;
   if (!dres)
 	{err=derr;return 0;}
 
-  // Mark it as debug-stripped.
-  HANDLE hf = CreateFile(exe.c_str(),GENERIC_READ|GENERIC_WRITE,0,NULL,OPEN_EXISTING,0,NULL); DWORD red;
-  if (hf==INVALID_HANDLE_VALUE)
-	{err="Unable to open '"+exe+"' to strip it of debugging information. "+le();
-	 return 0;}
-  IMAGE_DOS_HEADER idh;
-  ReadFile(hf,&idh,sizeof(idh),&red,NULL);
-  if (red!=sizeof(idh))
-	{err="Unable to open '"+exe+"' header to strip it of debugging information.";
-	 return 0;}
-  DWORD off = idh.e_lfanew+sizeof(DWORD);
-  red=SetFilePointer(hf,off,NULL,FILE_BEGIN);
-  if (red!=off)
-	{err="Unable to find header of '"+exe+"' to strip it of debugging information.";
-	 return 0;}
-  IMAGE_FILE_HEADER pfh;
-  ReadFile(hf,&pfh,sizeof(pfh),&red,NULL);
-  if (red!=sizeof(pfh))
-	{err="Unable to read header of '"+exe+"' to strip it of debugging information.";
-	 return 0;}
-  bool already = ((pfh.Characteristics & IMAGE_FILE_DEBUG_STRIPPED)>0);
-  if (!already)
-  { pfh.Characteristics |= IMAGE_FILE_DEBUG_STRIPPED;
-	SetFilePointer(hf,off,NULL,FILE_BEGIN);
-	WriteFile(hf,&pfh,sizeof(pfh),&red,NULL);
+  if (!MarkDebugStripped(exe,err))
+	return 0;
+  if (opts->cache && keyed)
+  { // what the .dbg was made from, and how big it came out
+	TMappedFile out;
+	if (out.Open(dbg.c_str()))
+	{ key.dbgsize = out.size;
+	  key.num     = num;
+	  out.Close();
+	  WriteDbgCache(fncache.c_str(),key);
+	}
   }
-  CloseHandle(hf);
   //
   err="";
   return num;
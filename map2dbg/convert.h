@@ -1,9 +1,53 @@
 #ifndef convertH
 #define convertH
 
-// convert -- takes the exe and its map file, and generates a .dbg file.
+// TMapScanStats -- how much of the map file the scanner visited. The map is
+// read in a single forward pass, so 'bytes' never exceeds the file size.
+struct TMapScanStats
+{ unsigned long lines;   // lines visited
+  unsigned long bytes;   // bytes visited
+  unsigned long symbols; // publics found
+};
+
+// TAliasFold -- what to do with several publics at the same address, e.g.
+// "c1_0" and "__acrtused". Folding keeps one of them as the symbol for that
+// address, and drops the others or moves them to the alias table:
+//   afKeepAll   -- no folding; every public is a symbol (the classic behaviour)
+//   afFirst     -- keep whichever the map lists first
+//   afDemangled -- prefer a demangled C++ name, then any other plain name,
+//                  then a mangled one, then a compiler label like "c1_0"
+//   afLongest   -- keep the longest name
+// Ties go to whichever the map lists first.
+enum TAliasFold {afKeepAll, afFirst, afDemangled, afLongest};
+
+// TConvertOptions -- knobs for convert. The defaults give the classic
+// behaviour.
+struct TConvertOptions
+{ int threads;          // threads for parsing the map's publics: 1=serial, 0=one per core
+  bool inmemory;        // build the whole .dbg in memory and write it with one fwrite
+  TAliasFold aliases;   // folding of publics at the same address
+  bool aliastable;      // when folding, keep the other names in an alias table
+  bool cache;           // skip the conversion if the exe and the map are as they were last time
+  bool skipsame;        // build the .dbg in memory, and don't write it if the one there is the same
+  TConvertOptions() : threads(1), inmemory(false), aliases(afKeepAll), aliastable(false), cache(false), skipsame(false) {}
+};
+
+// TConvertTimes -- wall-clock seconds spent in each phase of a conversion.
+// When these are asked for, all the publics are read before the first one is
+// added, so that the phases don't overlap.
+struct TConvertTimes
+{ double map; // TMapFile: opening the map and reading its publics
+  double add; // TDebugFile::AddSymbol, for all of them
+  double end; // TDebugFile::End: the hash tables, the headers, the write
+};
+
+// convert -- takes the exe and its map file, and generates a .dbg file. If
+// there's no "<exe>.map", it reads "<exe>.map.gz" or "<exe>.map.zst" instead.
 // also marks the executable as debug-stripped.
-// returns the number of symbols converted
-int convert(AnsiString exe,AnsiString &err);
+// returns the number of symbols converted. If 'stats' is given, it receives
+// the map scanner's statistics; if 'times' is, the time taken by each phase.
+// With opts->cache, a conversion that the cache file "<exe>.m2dcache" shows
+// to be unneeded just returns the count from last time (see dbgcache.h).
+int convert(AnsiString exe,AnsiString &err,const TConvertOptions *opts=NULL,TMapScanStats *stats=NULL,TConvertTimes *times=NULL);
 
 #endif
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib,"psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#include "vclshim.h"
+#include "peimage.h"
+#pragma hdrstop
+#include "convert.h"
+#include "workers.h"
+
+//============================================================================
+// convertbench -- scaling benchmark for convert(). Not part of map2dbg
+// itself; build it on its own, e.g.
+//   bcc32 convertbench.cpp convert.cpp mapline.cpp workers.cpp mmfile.cpp peimage.cpp namearena.cpp dbgcache.cpp mapstream.cpp
+//   g++ -O2 convertbench.cpp convert.cpp mapline.cpp workers.cpp mmfile.cpp peimage.cpp namearena.cpp dbgcache.cpp mapstream.cpp -lpthread -o convertbench
+// Syntax: convertbench [/dir:path] [/threads:n] [/inmemory] [/keep] [publics ...]
+// For each count of publics (by default 10k, 100k, 1M and 10M) it writes a
+// synthetic Borland-style map, and a minimal PE image to go with it, into
+// 'dir' (by default the current one). Then it converts them, and reports
+//   map -- TMapFile: opening the map and reading its publics
+//   add -- TDebugFile::AddSymbol, for all of them
+//   end -- TDebugFile::End: hash tables, headers and the write
+// each in seconds, millions of symbols per second, and MB per second (of the
+// map for 'map', and of the .dbg for the others), plus the process's peak
+// memory so far. Counts are run in increasing order, so that each peak is
+// that of the biggest conversion yet. The files are deleted afterwards,
+// unless /keep is given.
+// The map has the sections map2dbg looks at, in the usual order: segments,
+// detailed map of segments, publics by name, publics by value. Names vary in
+// length like real ones do, and most symbols are code.
+//============================================================================
+
+static double PeakMemoryMB()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(),&pmc,sizeof(pmc)))
+	return 0;
+  return pmc.PeakWorkingSetSize/1048576.0;
+#else
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF,&ru)!=0)
+	return 0;
+  return ru.ru_maxrss/1024.0; // ru_maxrss is in KB
+#endif
+}
+
+static double FileMB(const char *fn)
+{
+  FILE *f = fopen(fn,"rb");
+  if (f==NULL)
+	return 0;
+  fseek(f,0,SEEK_END);
+  double mb = ftell(f)/1048576.0;
+  fclose(f);
+  return mb;
+}
+
+// The four segments of a Borland image, and the share of publics in each
+struct TBenchSeg {const char *name, *cls, *sec; unsigned long start; int permille;};
+static const TBenchSeg benchsegs[4] =
+{ {"_TEXT","CODE",".text",0x00401000,800},
+  {"_DATA","DATA",".data",0,150},
+  {"_BSS", "BSS", ".bss", 0,40},
+  {"_TLS", "TLS", ".tls", 0,10} };
+
+struct TBenchSym {unsigned short seg; unsigned long off; unsigned long unit, id;};
+
+static void SymName(const TBenchSym &s,char *buf)
+{
+  switch (s.id%4)
+  { case 0:  sprintf(buf,"Unit%lu::TClass%lu::Method%lu",s.unit,s.id/16,s.id); break;
+	case 1:  sprintf(buf,"Unit%lu::_%lu",s.unit,s.id); break;
+	case 2:  sprintf(buf,"__fastcall Unit%lu::TForm%lu::Handler%lu(System::TObject *)",s.unit,s.id/32,s.id); break;
+	default: sprintf(buf,"_Proc%lu",s.id); break;
+  }
+}
+
+// GenerateMap -- writes the map, and returns the size of each segment
+static bool GenerateMap(const char *fn,unsigned long n,std::vector<TBenchSym> *syms,unsigned long segsize[4])
+{
+  syms->resize(n);
+  unsigned long at=0;
+  for (int g=0; g<4; g++)
+  {
+	unsigned long cnt = (g==3) ? n-at : (unsigned long)((double)n*benchsegs[g].permille/1000);
+	unsigned long off = 0x100;
+	for (unsigned long i=0; i<cnt; i++)
+	{ TBenchSym &s = (*syms)[at+i];
+	  s.seg  = (unsigned short)(g+1);
+	  s.off  = off;
+	  s.unit = (at+i)/500;
+	  s.id   = at+i;
+	  off += 4 + ((at+i)*7919)%60; // symbols 4 to 64 bytes apart
+	}
+	segsize[g] = off+0x100;
+	at += cnt;
+  }
+  //
+  FILE *f = fopen(fn,"wb");
+  if (f==NULL)
+	return false;
+  setvbuf(f,NULL,_IOFBF,1<<20);
+  fprintf(f,"\r\n Start         Length     Name                   Class\r\n");
+  unsigned long start = benchsegs[0].start;
+  for (int g=0; g<4; g++)
+  {
+	unsigned long st = (g==3) ? 0 : start;
+	fprintf(f," %04X:%08lX %09lXH %-22s %s\r\n",g+1,st,segsize[g],benchsegs[g].name,benchsegs[g].cls);
+	if (g<3)
+	  start += (segsize[g]+0xFFF)&~0xFFFUL;
+  }
+  fprintf(f,"\r\n\r\nDetailed map of segments\r\n\r\n");
+  for (unsigned long u=0; u*500<n; u++)
+  { const TBenchSym &s = (*syms)[u*500];
+	fprintf(f," %04X:%08lX %08lX C=%-6s S=%-8s G=(none)   M=UNIT%lu ACBP=A9\r\n",s.seg,s.off,500UL*16,benchsegs[s.seg-1].cls,benchsegs[s.seg-1].name,u);
+  }
+  char name[200];
+  fprintf(f,"\r\n\r\n  Address             Publics by Name\r\n\r\n");
+  unsigned long stride = 7919; // visits every symbol once, in a scrambled order
+  while (n>1 && n%stride==0) stride+=2;
+  for (unsigned long i=0, k=0; i<n; i++, k=(k+stride)%n)
+  { const TBenchSym &s = (*syms)[k];
+	SymName(s,name);
+	fprintf(f," %04X:%08lX       %s\r\n",s.seg,s.off,name);
+  }
+  fprintf(f,"\r\n\r\n  Address             Publics by Value\r\n\r\n");
+  for (unsigned long i=0; i<n; i++)
+  { const TBenchSym &s = (*syms)[i];
+	SymName(s,name);
+	fprintf(f," %04X:%08lX       %s\r\n",s.seg,s.off,name);
+  }
+  fprintf(f,"\r\nProgram entry point at 0001:00000100\r\n\r\n");
+  return fclose(f)==0;
+}
+
+// GenerateImage -- a minimal PE32: headers and a section table, no content
+static bool GenerateImage(const char *fn,const unsigned long segsize[4])
+{
+  const DWORD falign=0x200, salign=0x1000;
+  std::vector<char> buf(falign,0);
+  IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER*)&buf[0];
+  dos->e_magic  = IMAGE_DOS_SIGNATURE;
+  dos->e_lfanew = 0x40;
+  *(DWORD*)&buf[0x40] = IMAGE_NT_SIGNATURE;
+  IMAGE_FILE_HEADER *fh = (IMAGE_FILE_HEADER*)&buf[0x44];
+  fh->Machine              = 0x14c; // i386
+  fh->NumberOfSections     = 4;
+  fh->TimeDateStamp        = 0x2A425E19;
+  fh->SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER32);
+  fh->Characteristics      = 0x010E; // executable, 32-bit, no line numbers or local symbols
+  IMAGE_OPTIONAL_HEADER32 *opt = (IMAGE_OPTIONAL_HEADER32*)(fh+1);
+  opt->Magic                  = IMAGE_NT_OPTIONAL_HDR32_MAGIC;
+  opt->ImageBase              = 0x00400000;
+  opt->SectionAlignment       = salign;
+  opt->FileAlignment          = falign;
+  opt->MajorSubsystemVersion  = 4;
+  opt->SizeOfHeaders          = falign;
+  opt->Subsystem              = 2; // GUI
+  opt->NumberOfRvaAndSizes    = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+  IMAGE_SECTION_HEADER *sec = (IMAGE_SECTION_HEADER*)(opt+1);
+  DWORD rva = salign;
+  for (int g=0; g<4; g++)
+  {
+	strncpy((char*)sec[g].Name,benchsegs[g].sec,IMAGE_SIZEOF_SHORT_NAME);
+	sec[g].Misc.VirtualSize = segsize[g];
+	sec[g].VirtualAddress   = rva;
+	sec[g].Characteristics  = (g==0) ? 0x60000020 : 0xC0000040;
+	rva += (segsize[g]+salign-1)&~(salign-1);
+  }
+  opt->SizeOfImage = rva;
+  //
+  FILE *f = fopen(fn,"wb");
+  if (f==NULL)
+	return false;
+  bool ok = fwrite(&buf[0],buf.size(),1,f)==1;
+  return fclose(f)==0 && ok;
+}
+
+static void Report(const char *what,double secs,unsigned long nsyms,double mb)
+{
+  if (secs<=0) secs=1e-9;
+  printf("  %-4s %9.3f s %9.2f Msym/s %9.1f MB/s\n",what,secs,nsyms/secs/1e6,mb/secs);
+}
+
+int main(int argc,char *argv[])
+{
+  std::string dir = ".";
+  TConvertOptions opts;
+  bool keep=false;
+  std::vector<unsigned long> counts;
+  for (int i=1; i<argc; i++)
+  {
+	std::string a = argv[i];
+	if (a[0]=='-') a[0]='/';
+	if (a.substr(0,5)=="/dir:")
+	  dir = a.substr(5);
+	else if (a.substr(0,9)=="/threads:")
+	  opts.threads = atoi(a.c_str()+9);
+	else if (a=="/inmemory")
+	  opts.inmemory = true;
+	else if (a=="/keep")
+	  keep = true;
+	else if (atol(a.c_str())>0)
+	  counts.push_back((unsigned long)atol(a.c_str()));
+	else
+	{
+	  fprintf(stderr,"Syntax: convertbench [/dir:path] [/threads:n] [/inmemory] [/keep] [publics ...]\n");
+	  return 1;
+	}
+  }
+  if (counts.size()==0)
+  { counts.push_back(10000); counts.push_back(100000);
+	counts.push_back(1000000); counts.push_back(10000000);
+  }
+  std::sort(counts.begin(),counts.end());
+  printf("threads %d%s, %d cores\n",opts.threads,opts.inmemory?", in memory":"",NumberOfCores());
+  //
+  for (size_t c=0; c<counts.size(); c++)
+  {
+	unsigned long n = counts[c];
+	char base[64];
+	sprintf(base,"/bench%lu",n);
+	std::string fnexe = dir+base+".exe", fnmap = dir+base+".map", fndbg = dir+base+".dbg";
+	unsigned long segsize[4];
+	{ std::vector<TBenchSym> syms;
+	  if (!GenerateMap(fnmap.c_str(),n,&syms,segsize) || !GenerateImage(fnexe.c_str(),segsize))
+	  {
+		fprintf(stderr,"Couldn't write the files for %lu publics in '%s'\n",n,dir.c_str());
+		return 1;
+	  }
+	}
+	double mapmb = FileMB(fnmap.c_str());
+	//
+	AnsiString err;
+	TMapScanStats stats;
+	TConvertTimes times;
+	double t0 = WallClock();
+	int num = convert(fnexe.c_str(),err,&opts,&stats,&times);
+	double total = WallClock()-t0;
+	double peak = PeakMemoryMB();
+	if (err!="")
+	{
+	  fprintf(stderr,"%lu publics: %s\n",n,err.c_str());
+	  return 1;
+	}
+	double dbgmb = FileMB(fndbg.c_str());
+	printf("%lu publics: %d converted, map %.1f MB, dbg %.1f MB, peak memory %.1f MB\n",n,num,mapmb,dbgmb,peak);
+	Report("map",times.map,num,mapmb);
+	Report("add",times.add,num,dbgmb);
+	Report("end",times.end,num,dbgmb);
+	Report("all",total,num,mapmb);
+	if (!keep)
+	{
+	  remove(fnexe.c_str());
+	  remove(fnmap.c_str());
+	  remove(fndbg.c_str());
+	}
+  }
+  return 0;
+}
@@ -76,7 +76,7 @@ typedef enum OMFHash {
 
 typedef struct OMFSignature {
     char        Signature[4];   // "NBxx"
-    long        filepos;        // offset in file
+    int         filepos;        // offset in file
 } OMFSignature;
 
 
@@ -91,9 +91,9 @@ typedef struct OMFSignature {
 typedef struct OMFDirHeader {
     unsigned short  cbDirHeader;    // length of this structure
     unsigned short  cbDirEntry;     // number of bytes in each directory entry
-    unsigned long   cDir;           // number of directorie entries
-    long            lfoNextDir;     // offset from base of next directory
-    unsigned long   flags;          // status flags
+    unsigned int    cDir;           // number of directorie entries
+    int             lfoNextDir;     // offset from base of next directory
+    unsigned int    flags;          // status flags
 } OMFDirHeader;
 
 
@@ -110,8 +110,8 @@ typedef struct OMFDirHeader {
 typedef struct OMFDirEntry {
     unsigned short  SubSection;     // subsection type (sst...)
     unsigned short  iMod;           // module index
-    long            lfo;            // large file offset of subsection
-    unsigned long   cb;             // number of bytes in subsection
+    int             lfo;            // large file offset of subsection
+    unsigned int    cb;             // number of bytes in subsection
 } OMFDirEntry;
 
 
@@ -121,8 +121,8 @@ typedef struct OMFDirEntry {
 typedef struct OMFSegDesc {
     unsigned short  Seg;            // segment index
     unsigned short  pad;            // pad to maintain alignment
-    unsigned long   Off;            // offset of code in segment
-    unsigned long   cbSeg;          // number of bytes in segment
+    unsigned int    Off;            // offset of code in segment
+    unsigned int    cbSeg;          // number of bytes in segment
 } OMFSegDesc;
 
 
@@ -153,9 +153,9 @@ typedef struct OMFModule {
 typedef struct OMFSymHash {
     unsigned short  symhash;        // symbol hash function index
     unsigned short  addrhash;       // address hash function index
-    unsigned long   cbSymbol;       // length of symbol information
-    unsigned long   cbHSym;         // length of symbol hash data
-    unsigned long   cbHAddr;        // length of address hashdata
+    unsigned int    cbSymbol;       // length of symbol information
+    unsigned int    cbHSym;         // length of symbol hash data
+    unsigned int    cbHAddr;        // length of address hashdata
 } OMFSymHash;
 
 
@@ -167,15 +167,15 @@ typedef struct OMFSymHash {
 //  begin on a long word boundary.
 
 typedef struct OMFTypeFlags {
-    unsigned long   sig     :8;
-    unsigned long   unused  :24;
+    unsigned int    sig     :8;
+    unsigned int    unused  :24;
 } OMFTypeFlags;
 
 
 typedef struct OMFGlobalTypes {
     OMFTypeFlags    flags;
-    unsigned long   cTypes;         // number of types
-    unsigned long   typeOffset[];   // array of offsets to types
+    unsigned int    cTypes;         // number of types
+    unsigned int    typeOffset[];   // array of offsets to types
 } OMFGlobalTypes;
 
 
@@ -189,7 +189,7 @@ typedef struct OMFGlobalTypes {
 typedef struct OMFPreCompMap {
     unsigned short  FirstType;      // first precompiled type index
     unsigned short  cTypes;         // number of precompiled types
-    unsigned long   signature;      // precompiled types signature
+    unsigned int    signature;      // precompiled types signature
     unsigned short  pad;
     CV_typ_t        map[];          // mapping of precompiled types
 } OMFPreCompMap;
@@ -206,7 +206,7 @@ typedef struct OMFPreCompMap {
 typedef struct OMFSourceLine {
     unsigned short  Seg;            // linker segment index
     unsigned short  cLnOff;         // count of line/offset pairs
-    unsigned long   offset[1];      // array of offsets in segment
+    unsigned int    offset[1];      // array of offsets in segment
     unsigned short  lineNbr[1];     // array of line lumber in source
 } OMFSourceLine;
 
@@ -220,7 +220,7 @@ typedef OMFSourceLine FAR * LPSL;
 typedef struct OMFSourceFile {
     unsigned short  cSeg;           // number of segments from source file
     unsigned short  reserved;       // reserved
-    unsigned long   baseSrcLn[1];   // base of OMFSourceLine tables
+    unsigned int    baseSrcLn[1];   // base of OMFSourceLine tables
                                     // this array is followed by array
                                     // of segment start/end pairs followed by
                                     // an array of linker indices
@@ -241,7 +241,7 @@ typedef OMFSourceFile FAR * LPSF;
 typedef struct OMFSourceModule {
     unsigned short  cFile;          // number of OMFSourceTables
     unsigned short  cSeg;           // number of segments in module
-    unsigned long   baseSrcFile[1]; // base of OMFSourceFile table
+    unsigned int    baseSrcFile[1]; // base of OMFSourceFile table
                                     // this array is followed by array
                                     // of segment start/end pairs followed
                                     // by an array of linker indices
@@ -268,7 +268,7 @@ typedef struct OMFFileIndex {
                                     // for module i. (0 for module w/o files)
     unsigned short  cfiles[1];      // Number of file names associated
                                     // with module i.
-    unsigned long   ulNames[1];     // Offsets from the beginning of this
+    unsigned int    ulNames[1];     // Offsets from the beginning of this
                                     // table to the file names
     char            Names[];        // The length prefixed names of files
 } OMFFileIndex;
@@ -280,29 +280,29 @@ typedef struct OMFFileIndex {
 //  described by the seg map table.
 
 typedef struct OMFOffsetMap16 {
-    unsigned long   csegment;       // Count of physical segments
+    unsigned int    csegment;       // Count of physical segments
 
     // The next six items are repeated for each segment
 
-    unsigned long   crangeLog;      // Count of logical offset ranges
+    unsigned int    crangeLog;      // Count of logical offset ranges
     unsigned short  rgoffLog[1];    // Array of logical offsets
     short           rgbiasLog[1];   // Array of logical->physical bias
-    unsigned long   crangePhys;     // Count of physical offset ranges
+    unsigned int    crangePhys;     // Count of physical offset ranges
     unsigned short  rgoffPhys[1];   // Array of physical offsets
     short           rgbiasPhys[1];  // Array of physical->logical bias
 } OMFOffsetMap16;
 
 typedef struct OMFOffsetMap32 {
-    unsigned long   csection;       // Count of physical sections
+    unsigned int    csection;       // Count of physical sections
 
     // The next six items are repeated for each section
 
-    unsigned long   crangeLog;      // Count of logical offset ranges
-    unsigned long   rgoffLog[1];    // Array of logical offsets
-    long            rgbiasLog[1];   // Array of logical->physical bias
-    unsigned long   crangePhys;     // Count of physical offset ranges
-    unsigned long   rgoffPhys[1];   // Array of physical offsets
-    long            rgbiasPhys[1];  // Array of physical->logical bias
+    unsigned int    crangeLog;      // Count of logical offset ranges
+    unsigned int    rgoffLog[1];    // Array of logical offsets
+    int             rgbiasLog[1];   // Array of logical->physical bias
+    unsigned int    crangePhys;     // Count of physical offset ranges
+    unsigned int    rgoffPhys[1];   // Array of physical offsets
+    int             rgbiasPhys[1];  // Array of physical->logical bias
 } OMFOffsetMap32;
 
 //  Pcode support.  This subsection contains debug information generated
@@ -343,7 +343,7 @@ typedef struct OMFMpcDebugInfo {
 typedef struct DirEntry{
     unsigned short  SubSectionType;
     unsigned short  ModuleIndex;
-    long            lfoStart;
+    int             lfoStart;
     unsigned short  Size;
 } DirEntry;
 
@@ -371,8 +371,8 @@ typedef struct oldsmd {
 
 typedef struct{
     unsigned short  Seg;
-    unsigned long   Off;
-    unsigned long   cbSeg;
+    unsigned int    Off;
+    unsigned int    cbSeg;
 } oldnsg32;
 
 typedef struct {
@@ -395,8 +395,8 @@ typedef struct OMFSegMapDesc {
     unsigned short  frame;       // logical segment index - interpreted via flags
     unsigned short  iSegName;    // segment or group name - index into sstSegName
     unsigned short  iClassName;  // class name - index into sstSegName
-    unsigned long   offset;      // byte offset of the logical within the physical segment
-    unsigned long   cbSeg;       // byte count of the logical segment or group
+    unsigned int    offset;      // byte offset of the logical within the physical segment
+    unsigned int    cbSeg;       // byte count of the logical segment or group
 } OMFSegMapDesc;
 
 typedef struct OMFSegMap {
@@ -20,9 +20,18 @@
 #endif
 #endif
 
+// map2dbg: 32-bit fields are declared 'int' rather than 'long' throughout,
+// so that these layouts also hold where long is 64 bits wide (LP64).
+#ifndef FAR
+#define FAR
+#endif
+#ifdef _WIN32
 #include <pshpack1.h>
-typedef unsigned long   CV_uoff32_t;
-typedef          long   CV_off32_t;
+#else
+#pragma pack(push,1)
+#endif
+typedef unsigned int    CV_uoff32_t;
+typedef          int    CV_off32_t;
 typedef unsigned short  CV_uoff16_t;
 typedef          short  CV_off16_t;
 typedef unsigned short  CV_typ_t;
@@ -1335,7 +1344,7 @@ typedef struct lfMFunc {
     unsigned char   reserved;       // reserved for future use
     unsigned short  parmcount;      // number of parameters
     CV_typ_t        arglist;        // type index of argument list
-    long            thisadjust;     // this adjuster (long because pad required anyway)
+    int             thisadjust;     // this adjuster (long because pad required anyway)
 } lfMFunc;
 
 
@@ -1423,7 +1432,7 @@ typedef struct lfPreComp {
     unsigned short  leaf;           // LF_PRECOMP
     unsigned short  start;          // starting type index included
     unsigned short  count;          // number of types in inclusion
-    unsigned long   signature;      // signature
+    unsigned int    signature;      // signature
     unsigned char   name[CV_ZEROLEN]; // length prefixed name of included type file
 } lfPreComp;
 
@@ -1434,7 +1443,7 @@ typedef struct lfPreComp {
 
 typedef struct lfEndPreComp {
     unsigned short  leaf;           // LF_ENDPRECOMP
-    unsigned long   signature;      // signature
+    unsigned int    signature;      // signature
 } lfEndPreComp;
 
 
@@ -1462,8 +1471,8 @@ typedef struct lfOEM {
 
 typedef struct lfTypeServer {
     unsigned short  leaf;           // LF_TYPESERVER
-    unsigned long   signature;      // signature
-    unsigned long   age;            // age of database used by this module
+    unsigned int    signature;      // signature
+    unsigned int    age;            // age of database used by this module
     unsigned char   name[CV_ZEROLEN];     // length prefixed name of PDB
 } lfTypeServer;
 
@@ -1549,7 +1558,7 @@ typedef struct lfFieldList {
 typedef struct mlMethod {
     CV_fldattr_t   attr;           // method attribute
     CV_typ_t       index;          // index to type record for procedure
-    unsigned long  vbaseoff[CV_ZEROLEN];    // offset in vfunctable if intro virtual
+    unsigned int   vbaseoff[CV_ZEROLEN];    // offset in vfunctable if intro virtual
 } mlMethod;
 
 
@@ -1659,7 +1668,7 @@ typedef struct lfUShort {
 
 typedef struct lfLong {
     unsigned short  leaf;           // LF_LONG
-    long            val;            // signed 32-bit value
+    int             val;            // signed 32-bit value
 } lfLong;
 
 
@@ -1669,7 +1678,7 @@ typedef struct lfLong {
 
 typedef struct lfULong {
     unsigned short  leaf;           // LF_ULONG
-    unsigned long   val;            // unsigned 32-bit value
+    unsigned int    val;            // unsigned 32-bit value
 } lfULong;
 
 
@@ -1939,7 +1948,7 @@ typedef struct lfOneMethod {
     unsigned short  leaf;           // LF_ONEMETHOD
     CV_fldattr_t    attr;           // method attribute
     CV_typ_t        index;          // index to type record for procedure
-    unsigned long   vbaseoff[CV_ZEROLEN];    // offset in vfunctable if
+    unsigned int    vbaseoff[CV_ZEROLEN];    // offset in vfunctable if
                                     // intro virtual followed by
                                     // length prefixed name of method
 } lfOneMethod;
@@ -2196,7 +2205,7 @@ typedef struct UDTSYM {
 typedef struct SEARCHSYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_SSEARCH
-    unsigned long   startsym;       // offset of the procedure
+    unsigned int    startsym;       // offset of the procedure
     unsigned short  seg;            // segment of symbol
 } SEARCHSYM;
 
@@ -2224,7 +2233,7 @@ typedef struct CFLAGSYM {
 typedef struct OBJNAMESYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_OBJNAME
-    unsigned long   signature;      // signature
+    unsigned int    signature;      // signature
     unsigned char   name[1];        // Length-prefixed name
 } OBJNAMESYM;
 
@@ -2280,9 +2289,9 @@ typedef DATASYM16 PUBSYM16;
 typedef struct PROCSYM16 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_GPROC16 or S_LPROC16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
     unsigned short  len;            // Proc length
     unsigned short  DbgStart;       // Debug start offset
     unsigned short  DbgEnd;         // Debug end offset
@@ -2299,9 +2308,9 @@ typedef struct PROCSYM16 {
 typedef struct THUNKSYM16 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_THUNK
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
     CV_uoff16_t     off;            // offset of symbol
     unsigned short  seg;            // segment of symbol
     unsigned short  len;            // length of thunk
@@ -2329,8 +2338,8 @@ typedef struct LABELSYM16 {
 typedef struct BLOCKSYM16 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_BLOCK16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
     unsigned short  len;            // Block length
     CV_uoff16_t     off;            // offset of symbol
     unsigned short  seg;            // segment of symbol
@@ -2340,8 +2349,8 @@ typedef struct BLOCKSYM16 {
 typedef struct WITHSYM16 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_WITH16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
     unsigned short  len;            // Block length
     CV_uoff16_t     off;            // offset of symbol
     unsigned short  seg;            // segment of symbol
@@ -2440,12 +2449,12 @@ typedef DATASYM32 PUBSYM32;
 typedef struct PROCSYM32 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_GPROC32 or S_LPROC32
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
-    unsigned long   len;            // Proc length
-    unsigned long   DbgStart;       // Debug start offset
-    unsigned long   DbgEnd;         // Debug end offset
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
+    unsigned int    len;            // Proc length
+    unsigned int    DbgStart;       // Debug start offset
+    unsigned int    DbgEnd;         // Debug end offset
     CV_uoff32_t     off;
     unsigned short  seg;
     CV_typ_t        typind;         // Type index
@@ -2459,9 +2468,9 @@ typedef struct PROCSYM32 {
 typedef struct THUNKSYM32 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_THUNK32
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
     CV_uoff32_t     off;
     unsigned short  seg;
     unsigned short  len;            // length of thunk
@@ -2486,9 +2495,9 @@ typedef struct LABELSYM32 {
 typedef struct BLOCKSYM32 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_BLOCK32
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   len;            // Block length
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    len;            // Block length
     CV_uoff32_t     off;            // Offset in code segment
     unsigned short  seg;            // segment of label
     unsigned char   name[1];        // Length-prefixed name
@@ -2498,9 +2507,9 @@ typedef struct BLOCKSYM32 {
 typedef struct WITHSYM32 {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_WITH32
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   len;            // Block length
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    len;            // Block length
     CV_uoff32_t     off;            // Offset in code segment
     unsigned short  seg;            // segment of label
     unsigned char   expr[1];        // Length-prefixed expression string
@@ -2568,7 +2577,7 @@ typedef struct THREADSYM32 {
 typedef struct SLINK32 {
     unsigned short  reclen;         // record length
     unsigned short  rectyp;         // S_SLINK32
-    unsigned long   framesize;      // frame size of parent procedure
+    unsigned int    framesize;      // frame size of parent procedure
     CV_off32_t      off;            // signed offset where the static link was saved relative to the value of reg
     unsigned short  reg;
 } SLINK32, FAR * LPSLINK32;
@@ -2576,14 +2585,14 @@ typedef struct SLINK32 {
 typedef struct PROCSYMMIPS {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_GPROCMIPS or S_LPROCMIPS
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
-    unsigned long   len;            // Proc length
-    unsigned long   DbgStart;       // Debug start offset
-    unsigned long   DbgEnd;         // Debug end offset
-    unsigned long   regSave;        // int register save mask
-    unsigned long   fpSave;         // fp register save mask
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
+    unsigned int    len;            // Proc length
+    unsigned int    DbgStart;       // Debug start offset
+    unsigned int    DbgEnd;         // Debug end offset
+    unsigned int    regSave;        // int register save mask
+    unsigned int    fpSave;         // fp register save mask
     CV_uoff32_t     intOff;         // int register save offset
     CV_uoff32_t     fpOff;          // fp register save offset
     CV_uoff32_t     off;            // Symbol offset
@@ -2598,8 +2607,8 @@ typedef struct PROCSYMMIPS {
 typedef struct REFSYM {
     unsigned short  reclen;     // Record length
     unsigned short  rectyp;     // S_PROCREF or S_DATAREF
-    unsigned long   sumName;    // SUC of the name
-    unsigned long   ibSym;          // Offset of actual symbol in $$Symbols
+    unsigned int    sumName;    // SUC of the name
+    unsigned int    ibSym;          // Offset of actual symbol in $$Symbols
     unsigned short  imod;       // Module containing the actual symbol
     unsigned short  usFill;     // align this record
 } REFSYM;
@@ -2616,33 +2625,33 @@ typedef struct ALIGNSYM {
 typedef struct PROCSYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_GPROC16 or S_LPROC16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
 } PROCSYM;
 
 
 typedef struct THUNKSYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_THUNK
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
-    unsigned long   pNext;          // pointer to next symbol
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
+    unsigned int    pNext;          // pointer to next symbol
 } THUNKSYM;
 
 typedef struct BLOCKSYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_BLOCK16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
 } BLOCKSYM;
 
 
 typedef struct WITHSYM {
     unsigned short  reclen;         // Record length
     unsigned short  rectyp;         // S_WITH16
-    unsigned long   pParent;        // pointer to the parent
-    unsigned long   pEnd;           // pointer to this blocks end
+    unsigned int    pParent;        // pointer to the parent
+    unsigned int    pEnd;           // pointer to this blocks end
 } WITHSYM;
 
 
@@ -3190,7 +3199,11 @@ typedef enum CV_HREG_e {
 
 } CV_HREG_e;
 
+#ifdef _WIN32
 #include <poppack.h>
+#else
+#pragma pack(pop)
+#endif
 
 #ifdef  __cplusplus
 #pragma warning ( default: 4200 )
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include "vclshim.h"
+#pragma hdrstop
+#include "dbgcache.h"
+#include "mmfile.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// dbgcache -- lets convert skip the conversion when nothing it depends on
+// has changed since the last one. An incremental build relinks the exe, and
+// so gives it a new timestamp (and usually a new checksum), even when the
+// code and the map are just as they were. The .dbg only copies those two
+// fields from the exe's headers, so it can be patched rather than rebuilt.
+//
+// The key is kept in "<exe>.m2dcache", a few lines of text:
+//   map2dbg cache 2
+//   image=<hex> sections=<hex> map=<hex> opts=<hex>
+//   timestamp=<hex> checksum=<hex> dbgsize=<hex> num=<decimal>
+// The hashes are a word-at-a-time multiply-xorshift: not cryptographic, just
+// fast enough that hashing a map of hundreds of MB costs a small fraction of
+// converting it.
+//============================================================================
+
+// CacheFormat -- bump it whenever the .dbg that convert writes changes, so
+// that caches made by older versions are ignored
+static const unsigned int CacheFormat = 2;
+
+static inline ULONGLONG Mix(ULONGLONG h,ULONGLONG w)
+{
+  h ^= w;
+  h *= 0x9E3779B97F4A7C15ULL;
+  return h ^ (h>>29);
+}
+
+static ULONGLONG HashBytes(const void *p,size_t n,ULONGLONG h=0x5D0C6F2A1B3E4978ULL)
+{
+  const unsigned char *s=(const unsigned char*)p;
+  size_t i=0;
+  for (; i+8<=n; i+=8)
+  { ULONGLONG w;
+	memcpy(&w,s+i,8);
+	h = Mix(h,w);
+  }
+  ULONGLONG w=0;
+  memcpy(&w,s+i,n-i);
+  return Mix(Mix(h,w),(ULONGLONG)n);
+}
+
+bool MakeDbgCacheKey(const TPEImage &pe,const char *fnmap,const TConvertOptions &opts,TDbgCacheKey *key,std::string &err)
+{
+  memset(key,0,sizeof(*key));
+  // everything that End copies from the headers, but for the timestamp and
+  // the checksum, and with the debug-stripped flag left out, since convert
+  // itself sets it
+  DWORD fields[6];
+  fields[0] = pe.FileHeader->Machine;
+  fields[1] = pe.FileHeader->Characteristics & ~IMAGE_FILE_DEBUG_STRIPPED;
+  fields[2] = (DWORD)pe.ImageBase();
+  fields[3] = pe.SizeOfImage();
+  fields[4] = (DWORD)pe.NumberOfSections;
+  fields[5] = pe.SectionAlignment();
+  key->image    = HashBytes(fields,sizeof(fields));
+  key->sections = HashBytes(pe.Sections,pe.NumberOfSections*sizeof(IMAGE_SECTION_HEADER));
+  key->timestamp = pe.FileHeader->TimeDateStamp;
+  key->checksum  = pe.CheckSum();
+  //
+  TMappedFile map;
+  if (!map.Open(fnmap))
+  {
+	err = map.err;
+	return false;
+  }
+  key->map = HashBytes(map.base,map.size);
+  //
+  unsigned int o[3];
+  o[0] = CacheFormat;
+  o[1] = (unsigned int)opts.aliases;
+  o[2] = opts.aliastable ? 1 : 0;
+  key->opts = HashBytes(o,sizeof(o));
+  return true;
+}
+
+bool ReadDbgCache(const char *fncache,TDbgCacheKey *key)
+{
+  memset(key,0,sizeof(*key));
+  FILE *f = fopen(fncache,"rt");
+  if (f==NULL)
+	return false;
+  unsigned int version=0;
+  unsigned long long image=0, sections=0, map=0, opts=0, dbgsize=0;
+  unsigned int timestamp=0, checksum=0;
+  int num=0;
+  int n = fscanf(f,"map2dbg cache %u image=%llx sections=%llx map=%llx opts=%llx timestamp=%x checksum=%x dbgsize=%llx num=%d",
+				 &version,&image,&sections,&map,&opts,&timestamp,&checksum,&dbgsize,&num);
+  fclose(f);
+  if (n!=9 || version!=CacheFormat)
+	return false;
+  key->image=image; key->sections=sections; key->map=map; key->opts=opts;
+  key->timestamp=timestamp; key->checksum=checksum; key->dbgsize=dbgsize; key->num=num;
+  return true;
+}
+
+bool WriteDbgCache(const char *fncache,const TDbgCacheKey &key)
+{
+  FILE *f = fopen(fncache,"wt");
+  if (f==NULL)
+	return false;
+  fprintf(f,"map2dbg cache %u\nimage=%016llx sections=%016llx map=%016llx opts=%016llx\ntimestamp=%08x checksum=%08x dbgsize=%llx num=%d\n",
+		  CacheFormat,(unsigned long long)key.image,(unsigned long long)key.sections,(unsigned long long)key.map,(unsigned long long)key.opts,
+		  (unsigned int)key.timestamp,(unsigned int)key.checksum,(unsigned long long)key.dbgsize,key.num);
+  return fclose(f)==0;
+}
+
+bool UseDbgCache(const char *fndbg,const TDbgCacheKey &cached,const TDbgCacheKey &key)
+{
+  if (cached.image!=key.image || cached.sections!=key.sections || cached.map!=key.map || cached.opts!=key.opts)
+	return false;
+  bool patch = (cached.timestamp!=key.timestamp || cached.checksum!=key.checksum);
+  TMappedFile dbg;
+  if (!dbg.Open(fndbg,patch))
+	return false;
+  if (dbg.size!=cached.dbgsize || dbg.size<sizeof(IMAGE_SEPARATE_DEBUG_HEADER))
+	return false;
+  IMAGE_SEPARATE_DEBUG_HEADER *isdh = (IMAGE_SEPARATE_DEBUG_HEADER*)dbg.base;
+  unsigned long long odd = sizeof(IMAGE_SEPARATE_DEBUG_HEADER) + (unsigned long long)isdh->NumberOfSections*sizeof(IMAGE_SECTION_HEADER);
+  if (isdh->Signature!=IMAGE_SEPARATE_DEBUG_SIGNATURE || isdh->TimeDateStamp!=cached.timestamp
+	  || odd+sizeof(IMAGE_DEBUG_DIRECTORY)>dbg.size)
+	return false; // not the .dbg that the cache was written for
+  if (!patch)
+	return true;
+  // the same fields that End fills in from the exe
+  IMAGE_DEBUG_DIRECTORY *idd = (IMAGE_DEBUG_DIRECTORY*)(dbg.base+odd);
+  isdh->TimeDateStamp = key.timestamp;
+  isdh->CheckSum      = key.checksum;
+  idd->TimeDateStamp  = key.timestamp;
+  return dbg.Flush();
+}
+//---------------------------------------------------------------------------
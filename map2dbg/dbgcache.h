@@ -0,0 +1,39 @@
+#ifndef dbgcacheH
+#define dbgcacheH
+
+#include <string>
+#include "peimage.h"
+#include "convert.h"
+
+// TDbgCacheKey -- what a .dbg was made from. 'image', 'sections', 'map' and
+// 'opts' decide whether it can be reused at all; the rest are the fields
+// that can be patched into it in place, and what convert returned.
+struct TDbgCacheKey
+{ ULONGLONG image;      // the PE header fields the .dbg copies, except the ones below
+  ULONGLONG sections;   // the section table
+  ULONGLONG map;        // the map's contents
+  ULONGLONG opts;       // the options that change the output, and the format version
+  DWORD     timestamp;  // the exe's TimeDateStamp
+  DWORD     checksum;   // and its CheckSum
+  ULONGLONG dbgsize;    // the size of the .dbg that was written
+  int       num;        // symbols converted
+};
+
+// MakeDbgCacheKey -- the key for converting 'pe' with the map 'fnmap'. The
+// map is hashed in full. Returns false, with 'err' saying why, if the map
+// can't be read.
+bool MakeDbgCacheKey(const TPEImage &pe,const char *fnmap,const TConvertOptions &opts,TDbgCacheKey *key,std::string &err);
+
+// ReadDbgCache and WriteDbgCache -- the key, kept in a small text file next
+// to the .dbg. Reading fails if the file is missing or isn't one of ours.
+bool ReadDbgCache(const char *fncache,TDbgCacheKey *key);
+bool WriteDbgCache(const char *fncache,const TDbgCacheKey &key);
+
+// UseDbgCache -- whether the .dbg that 'cached' describes can stand for the
+// conversion that 'key' describes. If it can, but was made for a different
+// timestamp or checksum, those are patched into it. Returns false if the
+// .dbg is missing, isn't the size it was, was made from something else, or
+// can't be patched; convert then does the whole conversion.
+bool UseDbgCache(const char *fndbg,const TDbgCacheKey &cached,const TDbgCacheKey &key);
+
+#endif
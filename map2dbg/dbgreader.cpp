@@ -0,0 +1,456 @@
+#include <string.h>
+#include <algorithm>
+#include "peimage.h"
+#include "cvexefmt.h"
+#pragma hdrstop
+#include "dbgreader.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// TDbgReader -- the other way round from TDebugFile: it reads a .dbg back,
+// for symbolizing addresses without dbghelp or a live process. The layout it
+// expects is the one described at the top of convert.cpp:
+//   @0.        IMAGE_SEPARATE_DEBUG_HEADER
+//   @.         NumberOfSections * IMAGE_SECTION_HEADER
+//   @.         ExportedNamesSize bytes of exported names
+//   @.         DebugDirectorySize bytes of IMAGE_DEBUG_DIRECTORYs, one of
+//              which is the CodeView one, pointing at...
+//   @oCv.      OMFSignature 'NB09', whose filepos gives the directory
+// and the directory lists the subsections. Those it knows are read into
+//   Symbols  -- from sstGlobalPub; every symbol with a segment, sorted by
+//               address. The S_GPROC32s, S_GDATA32s and S_GTHREAD32s in
+//               sstGlobalSym are the same symbols again: they give them
+//               their kinds, and the procedures their lengths. One found
+//               only there is added.
+//   Modules  -- from the sstModules, whose OMFSegDescs go into 'ranges'
+//   lines    -- from the sstSrcModules, each with the module it came from
+//   aliases  -- from sstAliases, map2dbg's table of folded names
+//   segments -- from sstSegMap: where each segment starts, as an RVA
+// Others are skipped. Every offset and count is checked against the size of
+// what it's in before it's used, so a damaged file gives an error, not a
+// crash. Fields are read through memcpy, since nothing in a .dbg promises to
+// be aligned.
+//============================================================================
+
+#define sstAliases 0x1a0 // map2dbg's own; see convert.cpp
+
+static inline WORD  GetW(const char *p) {WORD w;  memcpy(&w,p,sizeof(w)); return w;}
+static inline DWORD GetD(const char *p) {DWORD d; memcpy(&d,p,sizeof(d)); return d;}
+
+// Fits -- whether 'len' bytes at 'off' lie within 'size'
+static inline bool Fits(ULONGLONG off,ULONGLONG len,ULONGLONG size) {return off<=size && len<=size-off;}
+
+static bool SymAddrLess(const TDbgSymbol &a,const TDbgSymbol &b)
+{
+  if (a.seg!=b.seg) return a.seg<b.seg;
+  return a.off<b.off;
+}
+
+void TDbgReader::Close()
+{
+  Symbols.clear(); Modules.clear();
+  segments.clear(); ranges.clear(); lines.clear(); files.clear(); aliases.clear();
+  ImageBase=0; TimeDateStamp=0;
+  file.Close();
+}
+
+bool TDbgReader::Open(const char *fn)
+{
+  Close();
+  err="";
+  if (!file.Open(fn))
+  {
+	err=file.err;
+	return false;
+  }
+  const std::string what = "'"+std::string(fn)+"'";
+  const char *base=file.base; ULONGLONG size=file.size;
+  //
+  IMAGE_SEPARATE_DEBUG_HEADER isdh;
+  if (size<sizeof(isdh))
+	{err=what+" is not a .dbg file (too short)."; Close(); return false;}
+  memcpy(&isdh,base,sizeof(isdh));
+  if (isdh.Signature!=IMAGE_SEPARATE_DEBUG_SIGNATURE)
+	{err=what+" is not a .dbg file (no DI header)."; Close(); return false;}
+  ImageBase     = isdh.ImageBase;
+  TimeDateStamp = isdh.TimeDateStamp;
+  ULONGLONG osec = sizeof(isdh);
+  ULONGLONG odir = osec + (ULONGLONG)isdh.NumberOfSections*sizeof(IMAGE_SECTION_HEADER) + isdh.ExportedNamesSize;
+  if (!Fits(osec,(ULONGLONG)isdh.NumberOfSections*sizeof(IMAGE_SECTION_HEADER),size) || !Fits(odir,isdh.DebugDirectorySize,size))
+	{err=what+" is truncated (section table or debug directory)."; Close(); return false;}
+  std::vector<IMAGE_SECTION_HEADER> secs(isdh.NumberOfSections);
+  if (secs.size()>0)
+	memcpy(&secs[0],base+osec,secs.size()*sizeof(IMAGE_SECTION_HEADER));
+  //
+  // the CodeView data
+  ULONGLONG ocv=0, szcv=0;
+  for (DWORD i=0; i+sizeof(IMAGE_DEBUG_DIRECTORY)<=isdh.DebugDirectorySize && szcv==0; i+=sizeof(IMAGE_DEBUG_DIRECTORY))
+  { IMAGE_DEBUG_DIRECTORY idd;
+	memcpy(&idd,base+odir+i,sizeof(idd));
+	if (idd.Type==IMAGE_DEBUG_TYPE_CODEVIEW)
+	  {ocv=idd.PointerToRawData; szcv=idd.SizeOfData;}
+  }
+  if (szcv==0)
+	{err=what+" has no CodeView debug information."; Close(); return false;}
+  if (!Fits(ocv,szcv,size) || szcv<sizeof(OMFSignature) || memcmp(base+ocv,"NB09",4)!=0)
+	{err=what+" doesn't have NB09 CodeView debug information."; Close(); return false;}
+  const char *cv = base+ocv;
+  //
+  // the subsection directory
+  DWORD lfodir = GetD(cv+offsetof(OMFSignature,filepos));
+  if (!Fits(lfodir,sizeof(OMFDirHeader),szcv))
+	{err=what+" has a bad CodeView directory."; Close(); return false;}
+  WORD  cbDirHeader = GetW(cv+lfodir+offsetof(OMFDirHeader,cbDirHeader));
+  WORD  cbDirEntry  = GetW(cv+lfodir+offsetof(OMFDirHeader,cbDirEntry));
+  DWORD cDir        = GetD(cv+lfodir+offsetof(OMFDirHeader,cDir));
+  if (cbDirEntry<sizeof(OMFDirEntry) || !Fits((ULONGLONG)lfodir+cbDirHeader,(ULONGLONG)cDir*cbDirEntry,szcv))
+	{err=what+" has a bad CodeView directory."; Close(); return false;}
+  const char *dir = cv+lfodir+cbDirHeader;
+  bool ok=true, segmap=false;
+  std::vector<TDbgSymbol> others; // from the other symbol tables
+  for (DWORD i=0; i<cDir && ok; i++)
+  {
+	const char *e = dir+i*cbDirEntry;
+	WORD  sst  = GetW(e+offsetof(OMFDirEntry,SubSection));
+	WORD  imod = GetW(e+offsetof(OMFDirEntry,iMod));
+	DWORD lfo  = GetD(e+offsetof(OMFDirEntry,lfo));
+	DWORD cb   = GetD(e+offsetof(OMFDirEntry,cb));
+	if (!Fits(lfo,cb,szcv))
+	  {ok=false; break;}
+	const char *p = cv+lfo;
+	switch (sst)
+	{ case sstModule:    ok = imod>0 && imod!=0xFFFF && ReadModule(p,cb,imod-1); break;
+	  case sstSrcModule: ok = imod>0 && imod!=0xFFFF && ReadSrcModule(p,cb,imod-1); break;
+	  case sstGlobalPub: ok = ReadGlobalPub(p,cb,&Symbols); break;
+	  case sstGlobalSym: ok = ReadGlobalPub(p,cb,&others); break; // laid out just the same
+	  case sstAliases:   ok = ReadAliases(p,cb); break;
+	  case sstSegMap:    ok = ReadSegMap(p,cb,secs.size()>0 ? &secs[0] : NULL,(DWORD)secs.size()); segmap=true; break;
+	  default: break; // a subsection we don't need
+	}
+  }
+  if (!ok)
+	{err=what+" has a damaged CodeView subsection."; Close(); return false;}
+  if (!segmap)
+  { // then segment n is section n
+	for (size_t i=0; i<secs.size(); i++)
+	{ TSegment g;
+	  g.rva = secs[i].VirtualAddress;
+	  g.len = secs[i].Misc.VirtualSize;
+	  segments.push_back(g);
+	}
+  }
+  //
+  std::stable_sort(Symbols.begin(),Symbols.end(),SymAddrLess);
+  MergeSymbols(others);
+  std::stable_sort(ranges.begin(),ranges.end());
+  std::stable_sort(lines.begin(),lines.end());
+  std::stable_sort(aliases.begin(),aliases.end());
+  return true;
+}
+
+// ReadModule -- OMFModule, cSeg * OMFSegDesc, then the name
+bool TDbgReader::ReadModule(const char *p,DWORD cb,int imod)
+{
+  const DWORD ohdr = offsetof(OMFModule,SegInfo);
+  if (cb<ohdr)
+	return false;
+  WORD cSeg = GetW(p+offsetof(OMFModule,cSeg));
+  ULONGLONG oname = ohdr + (ULONGLONG)cSeg*sizeof(OMFSegDesc);
+  if (!Fits(oname,1,cb) || !Fits(oname+1,(BYTE)p[oname],cb))
+	return false;
+  if ((int)Modules.size()<=imod)
+  { TDbgName none = {"",0};
+	Modules.resize(imod+1,none);
+  }
+  Modules[imod].name = p+oname+1;
+  Modules[imod].len  = (BYTE)p[oname];
+  for (WORD k=0; k<cSeg; k++)
+  { const char *sd = p+ohdr+k*sizeof(OMFSegDesc);
+	TRange r;
+	r.seg  = GetW(sd+offsetof(OMFSegDesc,Seg));
+	r.off  = GetD(sd+offsetof(OMFSegDesc,Off));
+	r.len  = GetD(sd+offsetof(OMFSegDesc,cbSeg));
+	r.imod = imod;
+	ranges.push_back(r);
+  }
+  return true;
+}
+
+// ReadSrcModule -- as BuildSrcModule writes it:
+//   WORD cFile, WORD cSeg, DWORD baseSrcFile[cFile], DWORD start/end[cSeg][2], WORD seg[cSeg]
+// then for each file, at its baseSrcFile:
+//   WORD cSeg, WORD pad, DWORD baseSrcLn[cSeg], DWORD start/end[cSeg][2], BYTE cbName, name
+// and for each of those segments, at its baseSrcLn:
+//   WORD Seg, WORD cLnOff, DWORD offset[cLnOff], WORD line[cLnOff]
+bool TDbgReader::ReadSrcModule(const char *p,DWORD cb,int imod)
+{
+  if (cb<4)
+	return false;
+  WORD cFile = GetW(p);
+  if (!Fits(4,(ULONGLONG)cFile*4,cb))
+	return false;
+  for (WORD f=0; f<cFile; f++)
+  {
+	DWORD bf = GetD(p+4+4*f);
+	if (!Fits(bf,4,cb))
+	  return false;
+	WORD cSeg = GetW(p+bf);
+	ULONGLONG oname = (ULONGLONG)bf + 4 + 12*(ULONGLONG)cSeg;
+	if (!Fits(oname,1,cb) || !Fits(oname+1,(BYTE)p[oname],cb))
+	  return false;
+	TDbgName fname = {p+oname+1,(BYTE)p[oname]};
+	int ifile = (int)files.size();
+	files.push_back(fname);
+	for (WORD s=0; s<cSeg; s++)
+	{
+	  DWORD bl = GetD(p+bf+4+4*s);
+	  if (!Fits(bl,4,cb))
+		return false;
+	  WORD seg = GetW(p+bl), n = GetW(p+bl+2);
+	  if (!Fits((ULONGLONG)bl+4,6*(ULONGLONG)n,cb))
+		return false;
+	  for (WORD k=0; k<n; k++)
+	  { TLine l;
+		l.seg  = seg;
+		l.off  = GetD(p+bl+4+4*k);
+		l.line = GetW(p+bl+4+4*n+2*k);
+		l.file = ifile;
+		l.imod = imod;
+		lines.push_back(l);
+	  }
+	}
+  }
+  return true;
+}
+
+// ReadGlobalPub -- OMFSymHash, then cbSymbol bytes of symbol records. The
+// hash tables after them aren't needed: sorting the symbols does as well.
+bool TDbgReader::ReadGlobalPub(const char *p,DWORD cb,std::vector<TDbgSymbol> *syms)
+{
+  if (cb<sizeof(OMFSymHash))
+	return false;
+  DWORD cbSymbol = GetD(p+offsetof(OMFSymHash,cbSymbol));
+  if (!Fits(sizeof(OMFSymHash),cbSymbol,cb))
+	return false;
+  return ReadSymbols(p+sizeof(OMFSymHash),cbSymbol,syms);
+}
+
+// ReadSymbols -- the records of the kinds we know, that have a segment
+bool TDbgReader::ReadSymbols(const char *sym,DWORD cbSymbol,std::vector<TDbgSymbol> *syms)
+{
+  for (DWORD at=0; at+4<=cbSymbol; )
+  {
+	WORD reclen = GetW(sym+at), rectyp = GetW(sym+at+2);
+	if (!Fits((ULONGLONG)at+2,reclen,cbSymbol))
+	  return false;
+	const char *r = sym+at;
+	TDbgSymbol s;
+	s.len    = 0;
+	s.rectyp = rectyp;
+	s.recoff = at;
+	DWORD oname = 0;
+	switch (rectyp)
+	{ case S_PUB32: case S_GDATA32: case S_LDATA32: case S_GTHREAD32: case S_LTHREAD32:
+		// DATASYM32 and THREADSYM32 are laid out just like PUBSYM32
+		oname = offsetof(PUBSYM32,name);
+		s.off = GetD(r+offsetof(PUBSYM32,off));
+		s.seg = GetW(r+offsetof(PUBSYM32,seg));
+		break;
+	  case S_GPROC32: case S_LPROC32:
+		oname = offsetof(PROCSYM32,name);
+		s.off = GetD(r+offsetof(PROCSYM32,off));
+		s.seg = GetW(r+offsetof(PROCSYM32,seg));
+		s.len = GetD(r+offsetof(PROCSYM32,len));
+		break;
+	  default: break; // S_END, S_ALIGN and the like
+	}
+	if (oname!=0)
+	{ if (!Fits(oname,1,(ULONGLONG)reclen+2) || !Fits(oname+1,(BYTE)r[oname],(ULONGLONG)reclen+2))
+		return false;
+	  s.name    = r+oname+1;
+	  s.namelen = (BYTE)r[oname];
+	  if (s.seg!=0)
+		syms->push_back(s);
+	}
+	at += reclen+2;
+  }
+  return true;
+}
+
+// MergeSymbols -- gives each public the kind, and if it's a procedure the
+// length, of the record with its name and address in sstGlobalSym. Those
+// with no public are added, after all the publics at their address, with a
+// recoff that no alias can have.
+void TDbgReader::MergeSymbols(std::vector<TDbgSymbol> &others)
+{
+  size_t npubs = Symbols.size();
+  for (size_t i=0; i<others.size(); i++)
+  { TDbgSymbol &o = others[i];
+	std::vector<TDbgSymbol>::iterator s = std::lower_bound(Symbols.begin(),Symbols.begin()+npubs,o,SymAddrLess);
+	for (; s!=Symbols.begin()+npubs && s->seg==o.seg && s->off==o.off; ++s)
+	  if (s->namelen==o.namelen && memcmp(s->name,o.name,o.namelen)==0)
+		break;
+	if (s!=Symbols.begin()+npubs && s->seg==o.seg && s->off==o.off)
+	{ s->rectyp = o.rectyp;
+	  s->len    = o.len;
+	}
+	else
+	{ o.recoff = 0xFFFFFFFF;
+	  Symbols.push_back(o);
+	}
+  }
+  if (Symbols.size()>npubs)
+	std::stable_sort(Symbols.begin(),Symbols.end(),SymAddrLess);
+}
+
+// ReadAliases -- DWORD cAlias, then (DWORD symoff, BYTE cbName, name) each
+bool TDbgReader::ReadAliases(const char *p,DWORD cb)
+{
+  if (cb<4)
+	return false;
+  DWORD n = GetD(p);
+  ULONGLONG at = 4;
+  for (DWORD i=0; i<n; i++)
+  {
+	if (!Fits(at,5,cb) || !Fits(at+5,(BYTE)p[at+4],cb))
+	  return false;
+	TAlias a;
+	a.symoff   = GetD(p+at);
+	a.name.name = p+at+5;
+	a.name.len  = (BYTE)p[at+4];
+	aliases.push_back(a);
+	at += 5+a.name.len;
+  }
+  return true;
+}
+
+// ReadSegMap -- OMFSegMap, then cSeg * OMFSegMapDesc. Each segment is
+// 'offset' into the section that 'frame' numbers.
+bool TDbgReader::ReadSegMap(const char *p,DWORD cb,const IMAGE_SECTION_HEADER *secs,DWORD nsecs)
+{
+  const DWORD ohdr = offsetof(OMFSegMap,rgDesc);
+  if (cb<ohdr)
+	return false;
+  WORD cSeg = GetW(p+offsetof(OMFSegMap,cSeg));
+  if (!Fits(ohdr,(ULONGLONG)cSeg*sizeof(OMFSegMapDesc),cb))
+	return false;
+  for (WORD k=0; k<cSeg; k++)
+  { const char *d = p+ohdr+k*sizeof(OMFSegMapDesc);
+	WORD frame = GetW(d+offsetof(OMFSegMapDesc,frame));
+	TSegment g;
+	g.rva = (frame>=1 && frame<=nsecs) ? secs[frame-1].VirtualAddress + GetD(d+offsetof(OMFSegMapDesc,offset)) : 0;
+	g.len = (frame>=1 && frame<=nsecs) ? GetD(d+offsetof(OMFSegMapDesc,cbSeg)) : 0;
+	segments.push_back(g);
+  }
+  return true;
+}
+
+
+// IsLabel -- whether the name, after any unit or class, is one that the
+// compiler made up, e.g. Sysinit::B3_2 or Consts::_16400: letters, digits,
+// '_', digits
+static bool IsLabel(const char *name,int len)
+{
+  int i=0;
+  for (int k=0; k+1<len; k++)
+	if (name[k]==':' && name[k+1]==':')
+	  i=k+2;
+  int start=i;
+  while (i<len && ((name[i]>='a' && name[i]<='z') || (name[i]>='A' && name[i]<='Z'))) i++;
+  int d1=i;
+  while (i<len && name[i]>='0' && name[i]<='9') i++;
+  if (i==len || name[i]!='_' || (i==d1 && d1!=start)) // B3_2 or _16400, not Item_1
+	return false;
+  int d2=++i;
+  while (i<len && name[i]>='0' && name[i]<='9') i++;
+  return i==len && i>d2;
+}
+
+bool TDbgReader::LookupRVA(DWORD rva,TDbgLookup *res) const
+{
+  for (size_t i=0; i<segments.size(); i++)
+	if (segments[i].len>0 && rva>=segments[i].rva && rva-segments[i].rva<segments[i].len)
+	{
+	  Lookup((WORD)(i+1),rva-segments[i].rva,res);
+	  return true;
+	}
+  memset(res,0,sizeof(*res));
+  res->imod=-1;
+  return false;
+}
+
+bool TDbgReader::Lookup(WORD seg,DWORD off,TDbgLookup *res) const
+{
+  res->seg  = seg;
+  res->off  = off;
+  res->sym  = NULL;
+  res->disp = 0;
+  res->imod = -1;
+  res->file = NULL;
+  res->line = 0;
+  //
+  // the symbol: the last at or before the address, or rather the first of
+  // those at that address that isn't a compiler's label, if any isn't. A
+  // procedure only covers its length.
+  TDbgSymbol key;
+  key.seg = seg;
+  key.off = off;
+  std::vector<TDbgSymbol>::const_iterator s = std::upper_bound(Symbols.begin(),Symbols.end(),key,SymAddrLess);
+  if (s!=Symbols.begin() && (s-1)->seg==seg)
+  {
+	--s;
+	while (s!=Symbols.begin() && (s-1)->seg==seg && (s-1)->off==s->off)
+	  --s;
+	std::vector<TDbgSymbol>::const_iterator named = s;
+	while (named!=Symbols.end() && named->seg==seg && named->off==s->off && IsLabel(named->name,named->namelen))
+	  ++named;
+	if (named!=Symbols.end() && named->seg==seg && named->off==s->off)
+	  s = named;
+	if (s->len==0 || off-s->off<s->len)
+	{ res->sym  = &*s;
+	  res->disp = off-s->off;
+	}
+  }
+  //
+  // the module
+  TRange rkey;
+  rkey.seg = seg;
+  rkey.off = off;
+  std::vector<TRange>::const_iterator r = std::upper_bound(ranges.begin(),ranges.end(),rkey);
+  if (r!=ranges.begin() && (r-1)->seg==seg && off-(r-1)->off<(r-1)->len)
+	res->imod = (r-1)->imod;
+  //
+  // the line: the last one at or before the address, as long as it's from
+  // the same module (if modules are known at all)
+  TLine lkey;
+  lkey.seg = seg;
+  lkey.off = off;
+  std::vector<TLine>::const_iterator l = std::upper_bound(lines.begin(),lines.end(),lkey);
+  if (l!=lines.begin() && (l-1)->seg==seg && (ranges.size()==0 || (l-1)->imod==res->imod))
+  { res->file = &files[(l-1)->file];
+	res->line = (l-1)->line;
+  }
+  return res->sym!=NULL || res->imod>=0 || res->file!=NULL;
+}
+
+void TDbgReader::Aliases(const TDbgSymbol *sym,std::vector<TDbgName> *names) const
+{
+  names->clear();
+  // other symbols at the same address, which weren't folded
+  size_t first = sym-&Symbols[0];
+  while (first>0 && Symbols[first-1].seg==sym->seg && Symbols[first-1].off==sym->off)
+	first--;
+  for (size_t i=first; i<Symbols.size() && Symbols[i].seg==sym->seg && Symbols[i].off==sym->off; i++)
+	if (&Symbols[i]!=sym)
+	{ TDbgName n = {Symbols[i].name,Symbols[i].namelen};
+	  names->push_back(n);
+	}
+  // and the names that were folded into it
+  TAlias key;
+  key.symoff = sym->recoff;
+  std::vector<TAlias>::const_iterator a = std::lower_bound(aliases.begin(),aliases.end(),key);
+  for (; a!=aliases.end() && a->symoff==sym->recoff; ++a)
+	names->push_back(a->name);
+}
+//---------------------------------------------------------------------------
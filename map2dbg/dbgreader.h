@@ -0,0 +1,86 @@
+#ifndef dbgreaderH
+#define dbgreaderH
+
+#include <string>
+#include <vector>
+#include "peimage.h"
+
+// TDbgSymbol -- one symbol from sstGlobalPub, or failing that from
+// sstGlobalSym. The name points into the mapped file, and isn't
+// nul-terminated.
+struct TDbgSymbol
+{ WORD  seg;
+  DWORD off;
+  DWORD len;        // an S_GPROC32's length; 0 for the other kinds
+  WORD  rectyp;     // S_PUB32, S_GPROC32, S_GDATA32, S_GTHREAD32, ...
+  DWORD recoff;     // its record's offset from the first symbol, as in sstAliases
+  const char *name;
+  int   namelen;
+};
+
+// TDbgName -- a module's or a source file's name, also in the mapped file
+struct TDbgName
+{ const char *name;
+  int len;
+};
+
+// TDbgLookup -- what an address resolved to. Any part of it may be missing.
+struct TDbgLookup
+{ WORD  seg;             // the address, as segment:offset
+  DWORD off;
+  const TDbgSymbol *sym; // the symbol it's in, or NULL
+  DWORD disp;            // how far into that symbol it is
+  int   imod;            // index into Modules, or -1
+  const TDbgName *file;  // the source file, or NULL if there are no line numbers for it
+  int   line;
+};
+
+// TDbgReader -- reads a .dbg file of the kind that TDebugFile writes: NB09
+// CodeView, with sstModule, sstSrcModule, sstGlobalPub, sstGlobalSym,
+// sstAliases and sstSegMap subsections. Everything is read up front into sorted tables,
+// so that each lookup is a few binary searches. Names point into the
+// mapping, so they're only valid until Close.
+class TDbgReader
+{ public:
+  TDbgReader() : ImageBase(0), TimeDateStamp(0) {}
+  bool Open(const char *fn);
+  void Close();
+  bool LookupRVA(DWORD rva,TDbgLookup *res) const;         // false if it's in no segment
+  bool Lookup(WORD seg,DWORD off,TDbgLookup *res) const;   // false if nothing was found for it
+  void Aliases(const TDbgSymbol *sym,std::vector<TDbgName> *names) const; // the other names at its address
+  //
+  DWORD ImageBase;                 // from the .dbg's header, i.e. the exe's
+  DWORD TimeDateStamp;
+  std::vector<TDbgSymbol> Symbols; // sorted by address; at one address, in the order written
+  std::vector<TDbgName>   Modules; // by iMod-1
+  std::string err;
+protected:
+  struct TSegment {DWORD rva, len;}; // by segment number-1
+  struct TRange                      // a module's part of a segment
+  { WORD seg; DWORD off, len; int imod;
+	bool operator<(const TRange &r) const {return seg!=r.seg ? seg<r.seg : off<r.off;}
+  };
+  struct TLine
+  { WORD seg; DWORD off; int line, file, imod;
+	bool operator<(const TLine &r) const {return seg!=r.seg ? seg<r.seg : off<r.off;}
+  };
+  struct TAlias
+  { DWORD symoff; TDbgName name;
+	bool operator<(const TAlias &r) const {return symoff<r.symoff;}
+  };
+  TMappedFile file;
+  std::vector<TSegment> segments;
+  std::vector<TRange>   ranges; // sorted
+  std::vector<TLine>    lines;  // sorted
+  std::vector<TDbgName> files;
+  std::vector<TAlias>   aliases; // sorted by symoff
+  bool ReadModule(const char *p,DWORD cb,int imod);
+  bool ReadSrcModule(const char *p,DWORD cb,int imod);
+  bool ReadGlobalPub(const char *p,DWORD cb,std::vector<TDbgSymbol> *syms);
+  bool ReadSymbols(const char *sym,DWORD cbSymbol,std::vector<TDbgSymbol> *syms);
+  void MergeSymbols(std::vector<TDbgSymbol> &others);
+  bool ReadAliases(const char *p,DWORD cb);
+  bool ReadSegMap(const char *p,DWORD cb,const IMAGE_SECTION_HEADER *secs,DWORD nsecs);
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include "peimage.h"
+#pragma hdrstop
+#include "dbgreader.h"
+
+//============================================================================
+// dbgsym -- symbolizes addresses offline, against the .dbg files that
+// map2dbg makes, in the manner of addr2line. It needs neither dbghelp nor
+// the process the addresses came from, so crash reports can be symbolized
+// afterwards, on any platform. Not part of map2dbg itself; build it on its
+// own, e.g.
+//   bcc32 dbgsym.cpp dbgreader.cpp mmfile.cpp
+//   g++ -O2 dbgsym.cpp dbgreader.cpp mmfile.cpp -o dbgsym
+// Syntax: dbgsym [/va] [/aliases] file.dbg ... [@addresses]
+// The addresses are read from the file 'addresses', or else from stdin, one
+// to a line, in hex with or without 0x:
+//   module+offset  -- e.g. calldemo.exe+0x1A2B; 'module' is matched against
+//                     the .dbg files' names, ignoring any path, extension
+//                     and case, and 'offset' is an RVA within it
+//   offset         -- an RVA in the first .dbg given; with /va, a virtual
+//                     address in it instead, from which its ImageBase is
+//                     taken off
+// For each one it writes a line: the address as given, then
+//   symbol+0xdisp [module] file:line
+// with ?? for any part that isn't known. With /aliases, the other names at
+// the symbol's address follow it, as (=name,name). Blank lines and lines
+// starting with # are copied through, so that reports keep their shape.
+// Each .dbg is read in once, into sorted tables, so every address after that
+// costs only a few binary searches.
+//============================================================================
+
+struct TDbgModuleFile
+{ std::string key; // the file name, without path or extension, in lower case
+  TDbgReader *dbg;
+};
+
+static std::string ModuleKey(const char *s,size_t len)
+{
+  size_t a=0;
+  for (size_t i=0; i<len; i++)
+	if (s[i]=='\\' || s[i]=='/' || s[i]==':')
+	  a=i+1;
+  size_t b=len;
+  for (size_t i=len; i>a; i--)
+	if (s[i-1]=='.')
+	  {b=i-1; break;}
+  std::string k(s+a,b-a);
+  for (size_t i=0; i<k.length(); i++)
+	k[i]=(char)tolower((unsigned char)k[i]);
+  return k;
+}
+
+// ParseHex -- the whole of s..e as a hex number, with or without 0x
+static bool ParseHex(const char *s,const char *e,unsigned long long *v)
+{
+  if (e-s>2 && s[0]=='0' && (s[1]=='x' || s[1]=='X'))
+	s+=2;
+  if (s==e || e-s>16)
+	return false;
+  *v=0;
+  for (; s<e; s++)
+  { int d;
+	if (*s>='0' && *s<='9') d=*s-'0';
+	else if (*s>='a' && *s<='f') d=*s-'a'+10;
+	else if (*s>='A' && *s<='F') d=*s-'A'+10;
+	else return false;
+	*v = (*v<<4) | d;
+  }
+  return true;
+}
+
+static void Symbolize(const char *s,size_t len,const std::vector<TDbgModuleFile> &mods,bool va,bool showaliases,std::vector<TDbgName> *names)
+{
+  fwrite(s,len,1,stdout);
+  const char *plus = (const char*)memchr(s,'+',len);
+  const TDbgReader *dbg = NULL;
+  unsigned long long a=0;
+  bool ok;
+  if (plus!=NULL)
+  { std::string key = ModuleKey(s,plus-s);
+	for (size_t i=0; i<mods.size() && dbg==NULL; i++)
+	  if (mods[i].key==key)
+		dbg=mods[i].dbg;
+	ok = ParseHex(plus+1,s+len,&a);
+  }
+  else
+  { dbg = mods[0].dbg;
+	ok = ParseHex(s,s+len,&a);
+	if (ok && va)
+	  a -= dbg->ImageBase;
+  }
+  TDbgLookup r;
+  if (!ok || dbg==NULL || a>0xFFFFFFFFUL || !dbg->LookupRVA((DWORD)a,&r))
+  {
+	fputs(" ?? [??] ??:0\n",stdout);
+	return;
+  }
+  if (r.sym!=NULL)
+  { printf(" %.*s+0x%X",r.sym->namelen,r.sym->name,(unsigned int)r.disp);
+	if (showaliases)
+	{ dbg->Aliases(r.sym,names);
+	  for (size_t i=0; i<names->size(); i++)
+		printf("%s%.*s",i==0?" (=":",",(*names)[i].len,(*names)[i].name);
+	  if (names->size()>0)
+		fputs(")",stdout);
+	}
+  }
+  else
+	fputs(" ??",stdout);
+  if (r.imod>=0)
+	printf(" [%.*s]",dbg->Modules[r.imod].len,dbg->Modules[r.imod].name);
+  else
+	fputs(" [??]",stdout);
+  if (r.file!=NULL)
+	printf(" %.*s:%d\n",r.file->len,r.file->name,r.line);
+  else
+	fputs(" ??:0\n",stdout);
+}
+
+int main(int argc,char *argv[])
+{
+  bool va=false, showaliases=false;
+  std::vector<TDbgModuleFile> mods;
+  const char *fnaddrs=NULL;
+  bool ok=true;
+  for (int i=1; i<argc && ok; i++)
+  {
+	std::string a = argv[i];
+	std::string sw = (a[0]=='-') ? "/"+a.substr(1) : a; // -x is the same as /x
+	if (sw=="/va")
+	  va=true;
+	else if (sw=="/aliases")
+	  showaliases=true;
+	else if (a[0]=='@')
+	  fnaddrs=argv[i]+1;
+	else if (a[0]=='-')
+	  ok=false;
+#ifdef _WIN32
+	else if (a[0]=='/')
+	  ok=false;
+#endif
+	else
+	{
+	  TDbgModuleFile m;
+	  m.key = ModuleKey(argv[i],strlen(argv[i]));
+	  m.dbg = new TDbgReader;
+	  if (!m.dbg->Open(argv[i]))
+	  {
+		fprintf(stderr,"%s\n",m.dbg->err.c_str());
+		return 1;
+	  }
+	  mods.push_back(m);
+	}
+  }
+  if (!ok || mods.size()==0)
+  {
+	fprintf(stderr,"Syntax: dbgsym [/va] [/aliases] file.dbg ... [@addresses]\n");
+	return 1;
+  }
+  FILE *in = stdin;
+  if (fnaddrs!=NULL && (in=fopen(fnaddrs,"rt"))==NULL)
+  {
+	fprintf(stderr,"Couldn't read the addresses from '%s'\n",fnaddrs);
+	return 1;
+  }
+  static char outbuf[1<<16];
+  setvbuf(stdout,outbuf,_IOFBF,sizeof(outbuf));
+  //
+  std::vector<TDbgName> names;
+  std::string line;
+  char buf[1024];
+  while (fgets(buf,sizeof(buf),in)!=NULL)
+  {
+	line += buf;
+	if (line[line.length()-1]!='\n' && !feof(in))
+	  continue; // the rest of a long line is still to come
+	size_t a=0, b=line.length();
+	while (a<b && (unsigned char)line[a]<=' ') a++;
+	while (b>a && (unsigned char)line[b-1]<=' ') b--;
+	if (a==b || line[a]=='#')
+	  fwrite(line.c_str(),line.length(),1,stdout);
+	else
+	  Symbolize(line.c_str()+a,b-a,mods,va,showaliases,&names);
+	line="";
+  }
+  if (in!=stdin)
+	fclose(in);
+  for (size_t i=0; i<mods.size(); i++)
+	delete mods[i].dbg;
+  return 0;
+}
@@ -1,59 +1,154 @@
 //---------------------------------------------------------------------------
 
+#ifdef __BORLANDC__
 #include <vcl.h>
+#endif
 #pragma hdrstop
 
-#include <windows.h>
-#include <imagehlp.h>
 #include <stdio.h>
-#include <system.hpp>
-#include <sysutils.hpp>
-#include <classes.hpp>
-#include "cvexefmt.h"
+#include <vector>
+#include "vclshim.h"
 #include "convert.h"
+#include "batch.h"
 
+#ifdef _WIN32
 #include <tchar.h>
+#else
+#define _tmain main
+typedef char _TCHAR;
+#endif
 //---------------------------------------------------------------------------
 
 #pragma argsused
 int _tmain(int argc, _TCHAR* argv[])
 {
-  bool ok = (argc==2);
-  if (argc==3 && argv[2]=="/nomap")
-	ok=true;
+  // switches and files may come in any order. Switches can be written /x or
+  // -x. With more than one file, they're converted as a batch.
+  std::vector<AnsiString> files;
+  TConvertOptions opts;
+  int jobs = 0;
+  bool ok = true;
+  for (int i=1; i<argc; i++)
+  {
+	AnsiString a=argv[i];
+	AnsiString sw = (a.SubString(1,1)=="-") ? "/"+a.SubString(2,a.Length()-1) : a; // -x is the same as /x
+	if (sw=="/nomap")
+	  ; // accepted for compatibility; it never had any effect
+	else if (sw=="/inmemory")
+	  opts.inmemory=true;
+	else if (sw.SubString(1,9)=="/threads:")
+	  opts.threads=StrToIntDef(sw.SubString(10,sw.Length()-9),-1);
+	else if (sw.SubString(1,6)=="/jobs:")
+	  jobs=StrToIntDef(sw.SubString(7,sw.Length()-6),-1);
+	else if (sw=="/aliases:all")
+	  opts.aliases=afKeepAll;
+	else if (sw=="/aliases:first")
+	  opts.aliases=afFirst;
+	else if (sw=="/aliases:demangled")
+	  opts.aliases=afDemangled;
+	else if (sw=="/aliases:longest")
+	  opts.aliases=afLongest;
+	else if (sw=="/aliastable")
+	  opts.aliastable=true;
+	else if (sw=="/cache")
+	  opts.cache=true;
+	else if (sw=="/skipsame")
+	  opts.skipsame=true;
+	else if (a.SubString(1,1)=="-")
+	  ok=false;
+#ifdef _WIN32
+	else if (a.SubString(1,1)=="/")
+	  ok=false;
+#endif
+	else
+	{ // elsewhere, anything else starting with / is an absolute path
+	  AnsiString err;
+	  if (!ExpandImageArg(a,&files,err))
+	  {
+		fputs(err.c_str(),stdout);
+		return 1;
+	  }
+	}
+  }
+  // the same image named twice (say, by a pattern and by name, or by two
+  // paths) is converted once. Two different images that would write the
+  // same .dbg, such as foo.exe and foo.dll, are left for ConvertBatch to
+  // refuse.
+  std::vector<AnsiString> uniq, full;
+  for (size_t i=0; i<files.size(); i++)
+  { AnsiString f=ExpandFileName(files[i]);
+	size_t j=0;
+	while (j<full.size() && !SameFileName(full[j],f))
+	  j++;
+	if (j==full.size())
+	{ uniq.push_back(files[i]);
+	  full.push_back(f);
+	}
+  }
+  files.swap(uniq);
+  if (files.size()==0 || opts.threads<0 || jobs<0)
+	ok=false;
   if (!ok)
   {
 	fputs("Map2Dbg version 1.4\n",stdout);
-	fputs("Syntax: map2dbg [/nomap] file.exe\n",stdout);
+	fputs("Syntax: map2dbg [/nomap] [/threads:n] [/inmemory] [/jobs:n] [/aliases:how] [/aliastable] [/cache] [/skipsame] file.exe|pattern|@list ...\n",stdout);
+	fputs("  /threads:n  parse the map on n threads; 0 means one per core\n",stdout);
+	fputs("  /inmemory   build the .dbg in memory, and write it in one go\n",stdout);
+	fputs("  /jobs:n     convert n images at once; 0 (the default) means one per core\n",stdout);
+	fputs("  /aliases:how  one symbol per address, picking the name that comes first,\n",stdout);
+	fputs("                is demangled, or is longest (first|demangled|longest); the\n",stdout);
+	fputs("                default, all, keeps every name as a symbol\n",stdout);
+	fputs("  /aliastable keep the names that /aliases folds away, in a table of their own\n",stdout);
+	fputs("  /cache      skip images whose map and sections haven't changed since the\n",stdout);
+	fputs("              last /cache conversion; just patch in the new timestamp\n",stdout);
+	fputs("  /skipsame   don't rewrite a .dbg that would come out the same, so that its\n",stdout);
+	fputs("              date doesn't change\n",stdout);
+	fputs("  pattern     e.g. bin\\*.bpl: every image that matches\n",stdout);
+	fputs("  @list       a file listing images or patterns, one per line\n",stdout);
 	return 1;
   }
 
-  AnsiString exe=argv[1];
-  if (argc==3)
-	exe=argv[2];
-  if (!FileExists(exe) && FileExists(exe+".exe"))
-	exe=exe+".exe";
-  if (!FileExists(exe) && FileExists(exe+".dll"))
-	exe=exe+".dll";
-  if (!FileExists(exe))
+  if (files.size()==1)
   {
-	fputs(("File '"+exe+"' not found").c_str(),stdout);
-	return 1;
-  }
+	AnsiString exe = files[0];
+	if (!FileExists(exe))
+	{
+	  fputs(("File '"+exe+"' not found").c_str(),stdout);
+	  return 1;
+	}
 
-  AnsiString err;
-  int num = convert(exe,err);
+	AnsiString err;
+	int num = convert(exe,err,&opts);
 
-  if (err=="")
+	if (err=="")
+	{
+	  fputs(("Converted "+AnsiString(num)+" symbols.").c_str(),stdout);
+	  return 0;
+	}
+	else
+	{
+	  fputs(err.c_str(),stdout);
+	  return 1;
+	}
+  }
+
+  // batch: one line per image, in the order given, then a summary
+  std::vector<TBatchJob> batch(files.size());
+  for (size_t i=0; i<files.size(); i++)
   {
-	fputs(("Converted "+AnsiString(num)+" symbols.").c_str(),stdout);
-	return 0;
+	batch[i].exe=files[i];
+	batch[i].num=0;
   }
-  else
+  int failed = ConvertBatch(&batch,&opts,jobs);
+  for (size_t i=0; i<batch.size(); i++)
   {
-	fputs(err.c_str(),stdout);
-	return 1;
+	if (batch[i].err=="")
+	  fputs((batch[i].exe+": Converted "+AnsiString(batch[i].num)+" symbols.\n").c_str(),stdout);
+	else
+	  fputs((batch[i].exe+": "+batch[i].err+"\n").c_str(),stdout);
   }
+  int total = (int)batch.size();
+  fputs(("Converted "+AnsiString(total-failed)+" of "+AnsiString(total)+" images.").c_str(),stdout);
+  return (failed==0) ? 0 : 1;
 }
 //---------------------------------------------------------------------------
-
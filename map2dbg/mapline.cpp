@@ -0,0 +1,250 @@
+#include <string.h>
+#pragma hdrstop
+#include "mapline.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#define MAPLINE_SSE2
+#include <emmintrin.h>
+#endif
+
+//============================================================================
+// ParsePublicLine -- decodes a line of the "Publics by Value" section.
+// Lines look like
+//   " 0001:0000035C       System.CloseHandle"
+//   " 0001:00000380  __acrtused"
+// i.e. the segment is at columns 1-4, the offset at columns 6-13 (0-based),
+// and the name is whatever is left from column 14 on, trimmed. Column 0 and
+// the ':' aren't checked, just as the old TStringList-based reader didn't.
+//
+// The scalar version goes digit by digit. The SSE2 version loads the first 16
+// bytes of the line in one go, classifies all twelve digits at once, and
+// folds pairs of nibbles into bytes with 16-bit lane arithmetic. AVX2 isn't
+// used: the fixed-layout part of the line is exactly one 16-byte register.
+//============================================================================
+
+static inline int HexDigit(char c)
+{
+  if (c>='0' && c<='9') return c-'0';
+  if (c>='A' && c<='F') return c-'A'+10;
+  if (c>='a' && c<='f') return c-'a'+10;
+  return -1;
+}
+
+// TrimName -- finds the name span in [14,len), skipping whitespace (anything
+// up to and including ' ') at either end.
+static inline void TrimName(const char *s,int len,TPublicLine *pl)
+{
+  int a=14, b=len;
+  while (a<b && (unsigned char)s[a]<=' ') a++;
+  while (b>a && (unsigned char)s[b-1]<=' ') b--;
+  pl->namepos=a;
+  pl->namelen=b-a;
+}
+
+bool ParsePublicLineScalar(const char *s,int len,TPublicLine *pl)
+{
+  if (len<15)          //minimal size = 15
+	return false;
+  unsigned long seg=0, off=0;
+  for (int i=1; i<=4; i++)
+  {
+	int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	seg = (seg<<4) | d;
+  }
+  for (int i=6; i<=13; i++)
+  {
+	int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	off = (off<<4) | d;
+  }
+  pl->seg = (unsigned short)seg;
+  pl->off = off;
+  TrimName(s,len,pl);
+  return true;
+}
+
+
+#ifdef MAPLINE_SSE2
+const bool HavePublicLineSSE2 = true;
+
+bool ParsePublicLineSSE2(const char *s,int len,TPublicLine *pl)
+{
+  // We need 16 readable bytes. Shorter lines (there are hardly any: the name
+  // is almost always two or more characters) take the scalar route.
+  if (len<16)
+	return ParsePublicLineScalar(s,len,pl);
+  __m128i v  = _mm_loadu_si128((const __m128i*)s);
+  // Folding in 0x20 maps 'A'-'F' onto 'a'-'f', so letters are tested on the
+  // folded bytes and digits on the raw ones. Bytes >=0x80 compare as
+  // negative, so they fail both range tests.
+  __m128i l  = _mm_or_si128(v,_mm_set1_epi8(0x20));
+  __m128i isdig = _mm_and_si128(_mm_cmpgt_epi8(v,_mm_set1_epi8('0'-1)),_mm_cmplt_epi8(v,_mm_set1_epi8('9'+1)));
+  __m128i isalp = _mm_and_si128(_mm_cmpgt_epi8(l,_mm_set1_epi8('a'-1)),_mm_cmplt_epi8(l,_mm_set1_epi8('f'+1)));
+  const int digitmask = 0x3FDE; // columns 1-4 and 6-13
+  if ((_mm_movemask_epi8(_mm_or_si128(isdig,isalp)) & digitmask) != digitmask)
+	return false;
+  // nibble = l-'0' for digits (which the fold left alone), l-'a'+10 for letters
+  __m128i nib = _mm_sub_epi8(l,_mm_or_si128(_mm_and_si128(isdig,_mm_set1_epi8('0')),_mm_andnot_si128(isdig,_mm_set1_epi8('a'-10))));
+  // Each 16-bit lane holds a (high nibble, low nibble) pair in memory order;
+  // (lo byte<<4)|(hi byte) turns it into the byte value. The offset pairs
+  // start at even columns (6,8,10,12); the segment pairs at odd ones (1,3),
+  // so shift those down a byte first.
+  const __m128i lomask = _mm_set1_epi16(0x00FF);
+  __m128i offw = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nib,lomask),4),_mm_srli_epi16(nib,8));
+  __m128i segn = _mm_srli_si128(nib,1);
+  __m128i segw = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(segn,lomask),4),_mm_srli_epi16(segn,8));
+  // offset bytes are now in lanes 3..6, segment bytes in lanes 0..1
+  unsigned int o = (unsigned int)_mm_cvtsi128_si32(_mm_packus_epi16(_mm_srli_si128(offw,6),_mm_setzero_si128()));
+  unsigned int g = (unsigned int)_mm_cvtsi128_si32(_mm_packus_epi16(segw,_mm_setzero_si128()));
+  pl->off = (o<<24) | ((o<<8)&0x00FF0000) | ((o>>8)&0x0000FF00) | (o>>24);
+  pl->seg = (unsigned short)(((g&0xFF)<<8) | ((g>>8)&0xFF));
+  TrimName(s,len,pl);
+  return true;
+}
+
+bool ParsePublicLine(const char *s,int len,TPublicLine *pl)
+{
+  return ParsePublicLineSSE2(s,len,pl);
+}
+
+#else
+const bool HavePublicLineSSE2 = false;
+
+bool ParsePublicLineSSE2(const char *s,int len,TPublicLine *pl)
+{
+  return ParsePublicLineScalar(s,len,pl);
+}
+
+bool ParsePublicLine(const char *s,int len,TPublicLine *pl)
+{
+  return ParsePublicLineScalar(s,len,pl);
+}
+#endif
+
+
+//============================================================================
+// ParseSegmentLine -- decodes a line of the segment table at the top of the
+// map. Lines look like
+//   " 0001:00401000 00008319CH _TEXT                  CODE"
+//   " 0002:004F9000 000040F4H .data                   DATA"
+// The length has as many digits as it needs, followed by an 'H'.
+//============================================================================
+
+// NextWord -- the span of the next run of non-spaces at or after *ai
+static bool NextWord(const char *s,int len,int *ai,int *apos,int *alen)
+{
+  int i=*ai;
+  while (i<len && (unsigned char)s[i]<=' ') i++;
+  int start=i;
+  while (i<len && (unsigned char)s[i]>' ') i++;
+  *ai=i;
+  *apos=start;
+  *alen=i-start;
+  return i>start;
+}
+
+bool ParseSegmentLine(const char *s,int len,TSegmentLine *sl)
+{
+  if (len<19 || s[5]!=':' || s[14]!=' ')
+	return false;
+  unsigned long seg=0, start=0, cb=0;
+  for (int i=1; i<=4; i++)
+  { int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	seg = (seg<<4) | d;
+  }
+  for (int i=6; i<=13; i++)
+  { int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	start = (start<<4) | d;
+  }
+  int i=15, ndigits=0;
+  for (; i<len && HexDigit(s[i])>=0; i++, ndigits++)
+	cb = (cb<<4) | HexDigit(s[i]);
+  if (ndigits==0 || ndigits>9 || i==len || s[i]!='H')
+	return false;
+  i++;
+  if (!NextWord(s,len,&i,&sl->namepos,&sl->namelen) || !NextWord(s,len,&i,&sl->clspos,&sl->clslen))
+	return false;
+  sl->seg = (unsigned short)seg;
+  sl->start = start;
+  sl->len = cb;
+  return true;
+}
+
+
+//============================================================================
+// ParseSegmentDetailLine -- decodes a line of the "Detailed map of segments".
+// Lines look like
+//   " 0001:00000380 0000014F C=CODE    S=_TEXT    G=(none)   M=C:\PROGRAM FILES\BORLAND\BDS\4.0\LIB\C0W32.OBJ ACBP=A9"
+//   " 0001:00000000 0000F3D4 C=CODE     S=.text    G=(none)   M=System   ACBP=A9"
+// There are a few hundred of these in a big map, against hundreds of
+// thousands of publics, so there's no need to be clever.
+//============================================================================
+
+// FindField -- the span of "key=value", where the value ends at the next
+// space. Returns false if there's no such key.
+static bool FindField(const char *s,int len,int from,const char *key,int *apos,int *alen)
+{
+  int keylen = (int)strlen(key);
+  for (int i=from; i+keylen<=len; i++)
+	if ((i==0 || s[i-1]==' ') && memcmp(s+i,key,keylen)==0)
+	{
+	  int e=i+keylen;
+	  while (e<len && s[e]!=' ') e++;
+	  *apos=i+keylen;
+	  *alen=e-*apos;
+	  return true;
+	}
+  return false;
+}
+
+bool ParseSegmentDetailLine(const char *s,int len,TSegmentDetailLine *dl)
+{
+  if (len<24 || s[5]!=':' || s[14]!=' ')
+	return false;
+  unsigned long seg=0, off=0, cb=0;
+  for (int i=1; i<=4; i++)
+  { int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	seg = (seg<<4) | d;
+  }
+  for (int i=6; i<=13; i++)
+  { int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	off = (off<<4) | d;
+  }
+  for (int i=15; i<=22; i++)
+  { int d = HexDigit(s[i]);
+	if (d<0)
+	  return false;
+	cb = (cb<<4) | d;
+  }
+  int modpos, modlen;
+  if (!FindField(s,len,23,"M=",&modpos,&modlen))
+	return false;
+  // the module runs up to " ACBP=", if there is one, rather than to the next space
+  int e=len;
+  for (int i=len-6; i>=modpos; i--)
+	if (memcmp(s+i," ACBP=",6)==0)
+	  {e=i; break;}
+  while (e>modpos && (unsigned char)s[e-1]<=' ') e--;
+  dl->seg = (unsigned short)seg;
+  dl->off = off;
+  dl->len = cb;
+  dl->modpos = modpos;
+  dl->modlen = e-modpos;
+  if (!FindField(s,len,23,"C=",&dl->clspos,&dl->clslen))
+	{dl->clspos=modpos; dl->clslen=0;}
+  return true;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,58 @@
+#ifndef maplineH
+#define maplineH
+
+// TPublicLine -- one decoded line of the map's "Publics by Value" section,
+// which has the fixed layout " SSSS:OOOOOOOO  name". The name is given as a
+// span of the line, already trimmed of surrounding whitespace.
+struct TPublicLine
+{ unsigned short seg;
+  unsigned long  off;
+  int            namepos; // offset of the name within the line
+  int            namelen; // may be zero
+};
+
+// ParsePublicLine -- validates and decodes one line (without its CR/LF).
+// Returns false if the line is shorter than 15 characters or if any of the
+// segment and offset digits isn't hex. It uses the SSE2 decoder when the
+// compiler targets SSE2, and the scalar one otherwise; both give identical
+// results. The two are also exported separately for benchmarking.
+bool ParsePublicLine(const char *s,int len,TPublicLine *pl);
+bool ParsePublicLineScalar(const char *s,int len,TPublicLine *pl);
+bool ParsePublicLineSSE2(const char *s,int len,TPublicLine *pl);
+extern const bool HavePublicLineSSE2; // false if ParsePublicLineSSE2 is really the scalar one
+
+// TSegmentLine -- one decoded line of the segment table at the top of the
+// map, " SSSS:SSSSSSSS LLLLLLLLLH name class". Start is the segment's address,
+// length its size in bytes. The name and class are given as spans of the line.
+struct TSegmentLine
+{ unsigned short seg;
+  unsigned long  start;
+  unsigned long  len;
+  int            namepos, namelen;
+  int            clspos, clslen;
+};
+
+// ParseSegmentLine -- validates and decodes one line (without its CR/LF).
+// Returns false unless it has the address, an 'H'-terminated length, and
+// both a name and a class.
+bool ParseSegmentLine(const char *s,int len,TSegmentLine *sl);
+
+// TSegmentDetailLine -- one decoded line of the map's "Detailed map of
+// segments", i.e. one module's contribution to a segment:
+//   " SSSS:OOOOOOOO LLLLLLLL C=class S=segment G=group M=module ACBP=xx"
+// The class and module are given as spans of the line. The module is
+// everything from after "M=" up to " ACBP=", trimmed, since it's usually a
+// path and may have spaces in it.
+struct TSegmentDetailLine
+{ unsigned short seg;
+  unsigned long  off;
+  unsigned long  len;
+  int            clspos, clslen;
+  int            modpos, modlen;
+};
+
+// ParseSegmentDetailLine -- validates and decodes one line (without its
+// CR/LF). Returns false unless it has the address, the length and an M=.
+bool ParseSegmentDetailLine(const char *s,int len,TSegmentDetailLine *dl);
+
+#endif
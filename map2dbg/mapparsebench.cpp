@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#pragma hdrstop
+#include "mapline.h"
+
+//============================================================================
+// mapparsebench -- microbenchmark for the "Publics by Value" line parser.
+// Not part of map2dbg itself; build it on its own, e.g.
+//   bcc32 mapparsebench.cpp mapline.cpp
+//   g++ -O2 mapparsebench.cpp mapline.cpp -o mapparsebench
+// Syntax: mapparsebench [file.map] [lines]
+// It takes the publics lines of the given map (by default the calldemo one),
+// repeats them until there are 'lines' of them (default 4 million), and times
+//   legacy -- what TMapFile::GetSymbol used to do: substrings plus two sscanf
+//   scalar -- ParsePublicLineScalar
+//   sse2   -- ParsePublicLineSSE2 (the same as scalar if SSE2 isn't compiled in)
+// Each pass folds its results into a checksum, so they can be compared.
+//============================================================================
+
+struct TLine {const char *s; int len;};
+
+// the line parser as it was before mapline.cpp, with std::string standing in
+// for AnsiString
+static bool LegacyParse(const char *p,int len,unsigned short *aseg,unsigned long *aoff,std::string *aname)
+{
+  std::string s(p,len);
+  if (s.length()<15)
+	return false;
+  std::string sseg = s.substr(1,4);
+  for (size_t i=0; i<sseg.length(); i++)
+  {
+	char c = sseg[i];
+	bool okay = (c>='0' && c<='9') || (c>='A' && c<='F') || (c>='a' && c<='f');
+	if (!okay)
+	  return false;
+  }
+  std::string soff = s.substr(6,8);
+  for (size_t i=0; i<soff.length(); i++)
+  {
+	char c = soff[i];
+	bool okay = (c>='0' && c<='9') || (c>='A' && c<='F') || (c>='a' && c<='f');
+	if (!okay)
+	  return false;
+  }
+  std::string sname = s.substr(14);
+  size_t a = 0, b = sname.length();
+  while (a<b && (unsigned char)sname[a]<=' ') a++;
+  while (b>a && (unsigned char)sname[b-1]<=' ') b--;
+  sname = sname.substr(a,b-a);
+  unsigned int val;
+  if (sscanf(sseg.c_str(),"%x",&val)!=1)
+	return false;
+  *aseg = (unsigned short)val;
+  if (sscanf(soff.c_str(),"%x",&val)!=1)
+	return false;
+  *aoff = val;
+  *aname = sname;
+  return true;
+}
+
+static double Seconds(clock_t t0)
+{
+  return (double)(clock()-t0)/CLOCKS_PER_SEC;
+}
+
+static void Report(const char *what,double secs,size_t nlines,size_t nbytes,unsigned long sum)
+{
+  if (secs<=0) secs=1e-9;
+  printf("%-7s %8.3f s  %7.1f ns/line  %8.1f MB/s  checksum %08lx\n",what,secs,secs*1e9/nlines,nbytes/secs/1e6,sum);
+}
+
+int main(int argc,char *argv[])
+{
+  const char *fnmap = (argc>1) ? argv[1] : "../calldemo/Debug_Build/calldemo.map";
+  size_t nlines = (argc>2) ? (size_t)atol(argv[2]) : 4000000;
+  FILE *f = fopen(fnmap,"rb");
+  if (f==NULL)
+  {
+	fprintf(stderr,"Can't open '%s'\n",fnmap);
+	return 1;
+  }
+  std::string text;
+  char buf[65536]; size_t red;
+  while ((red=fread(buf,1,sizeof(buf),f))>0)
+	text.append(buf,red);
+  fclose(f);
+
+  // gather the publics lines, i.e. everything after " Publics by Value"
+  std::vector<std::string> pubs;
+  size_t at = text.find(" Publics by Value");
+  if (at!=std::string::npos)
+	at = text.find('\n',at);
+  while (at!=std::string::npos && at+1<text.length())
+  {
+	size_t eol = text.find('\n',at+1);
+	if (eol==std::string::npos)
+	  eol = text.length();
+	std::string l = text.substr(at+1,eol-at-1);
+	while (!l.empty() && (l[l.length()-1]=='\r' || l[l.length()-1]=='\n'))
+	  l.erase(l.length()-1);
+	if (!l.empty())
+	  pubs.push_back(l);
+	at = (eol<text.length()) ? eol : std::string::npos;
+  }
+  if (pubs.empty())
+  {
+	fprintf(stderr,"'%s' doesn't list any publics\n",fnmap);
+	return 1;
+  }
+
+  // scale them up into one contiguous buffer, as the mapped file would be
+  std::string big;
+  std::vector<TLine> lines(nlines);
+  std::vector<size_t> starts(nlines);
+  for (size_t i=0; i<nlines; i++)
+  {
+	const std::string &l = pubs[i%pubs.size()];
+	starts[i] = big.length();
+	big += l;
+	big += "\r\n";
+  }
+  for (size_t i=0; i<nlines; i++)
+  {
+	lines[i].s   = big.data()+starts[i];
+	lines[i].len = (int)pubs[i%pubs.size()].length();
+  }
+  printf("%lu publics from '%s', scaled to %lu lines (%.1f MB); SSE2 %s\n",
+	(unsigned long)pubs.size(),fnmap,(unsigned long)nlines,big.length()/1e6,HavePublicLineSSE2?"on":"off");
+
+  clock_t t0; unsigned long sum;
+  //
+  t0=clock(); sum=0;
+  for (size_t i=0; i<nlines; i++)
+  { unsigned short seg; unsigned long off; std::string name;
+	if (LegacyParse(lines[i].s,lines[i].len,&seg,&off,&name))
+	  sum = sum*31 + seg + off + (unsigned long)name.length();
+  }
+  Report("legacy",Seconds(t0),nlines,big.length(),sum);
+  //
+  t0=clock(); sum=0;
+  for (size_t i=0; i<nlines; i++)
+  { TPublicLine pl;
+	if (ParsePublicLineScalar(lines[i].s,lines[i].len,&pl))
+	  sum = sum*31 + pl.seg + pl.off + (unsigned long)pl.namelen;
+  }
+  Report("scalar",Seconds(t0),nlines,big.length(),sum);
+  //
+  t0=clock(); sum=0;
+  for (size_t i=0; i<nlines; i++)
+  { TPublicLine pl;
+	if (ParsePublicLineSSE2(lines[i].s,lines[i].len,&pl))
+	  sum = sum*31 + pl.seg + pl.off + (unsigned long)pl.namelen;
+  }
+  Report("sse2",Seconds(t0),nlines,big.length(),sum);
+  return 0;
+}
@@ -0,0 +1,174 @@
+#include <string.h>
+#ifdef MAP2DBG_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MAP2DBG_ZSTD
+#include <zstd.h>
+#endif
+#pragma hdrstop
+#include "mapstream.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// mapstream -- reading map files that were archived compressed. Maps are
+// large and very repetitive, so they shrink ten- or twentyfold; this lets
+// TMapFile read them as they are, rather than needing them decompressed to
+// disk first. Multi-member gzip files, and zstd files of several frames, are
+// read right through, as 'cat'ing compressed files together makes them.
+//============================================================================
+
+TMapCompression MapCompression(const char *data,size_t size)
+{
+  const unsigned char *d = (const unsigned char*)data;
+  if (size>=2 && d[0]==0x1F && d[1]==0x8B)
+	return mcGzip;
+  if (size>=4 && d[0]==0x28 && d[1]==0xB5 && d[2]==0x2F && d[3]==0xFD)
+	return mcZstd;
+  return mcNone;
+}
+
+
+#ifdef MAP2DBG_ZLIB
+class TGzipStream : public TMapStream
+{ public:
+  TGzipStream(const char *adata,size_t asize) : data((const unsigned char*)adata), left(asize), done(false)
+  { memset(&zs,0,sizeof(zs));
+	ok = (inflateInit2(&zs,15+16)==Z_OK); // 15-bit window, gzip header
+	if (!ok)
+	  err="Couldn't start decompressing the map";
+  }
+  ~TGzipStream() {if (ok) inflateEnd(&zs);}
+  virtual int Read(char *buf,int len);
+protected:
+  z_stream zs;
+  const unsigned char *data; // the compressed data not yet handed to zlib
+  size_t left;
+  bool ok, done;
+};
+
+int TGzipStream::Read(char *buf,int len)
+{
+  if (!ok)
+	return -1;
+  zs.next_out  = (Bytef*)buf;
+  zs.avail_out = (uInt)len;
+  while (!done && zs.avail_out>0)
+  {
+	if (zs.avail_in==0 && left>0)
+	{ // zlib counts input in uInts, so a huge file goes in in slices
+	  uInt n = (left>0x40000000UL) ? 0x40000000UL : (uInt)left;
+	  zs.next_in  = (Bytef*)data;
+	  zs.avail_in = n;
+	  data += n;
+	  left -= n;
+	}
+	int r = inflate(&zs,Z_NO_FLUSH);
+	if (r==Z_STREAM_END)
+	{ // another member may follow
+	  if (zs.avail_in==0 && left>0)
+		continue; // look at the next slice first
+	  if (zs.avail_in>=2 && zs.next_in[0]==0x1F && zs.next_in[1]==0x8B)
+		inflateReset(&zs);
+	  else
+		done=true; // anything else after it is ignored, as gzip does
+	}
+	else if (r==Z_BUF_ERROR && zs.avail_in==0 && left==0)
+	{
+	  err="The compressed map file is truncated";
+	  ok=false;
+	  return -1;
+	}
+	else if (r!=Z_OK)
+	{
+	  err="The compressed map file is corrupt";
+	  ok=false;
+	  return -1;
+	}
+  }
+  return len-(int)zs.avail_out;
+}
+#endif
+
+
+#ifdef MAP2DBG_ZSTD
+class TZstdStream : public TMapStream
+{ public:
+  TZstdStream(const char *data,size_t size) : ok(true), pending(0)
+  { in.src=data; in.size=size; in.pos=0;
+	ds = ZSTD_createDStream();
+	if (ds==NULL || ZSTD_isError(ZSTD_initDStream(ds)))
+	{ err="Couldn't start decompressing the map";
+	  ok=false;
+	}
+  }
+  ~TZstdStream() {if (ds!=NULL) ZSTD_freeDStream(ds);}
+  virtual int Read(char *buf,int len);
+protected:
+  ZSTD_DStream *ds;
+  ZSTD_inBuffer in;
+  bool ok;
+  size_t pending; // nonzero while a frame isn't finished
+};
+
+int TZstdStream::Read(char *buf,int len)
+{
+  if (!ok)
+	return -1;
+  ZSTD_outBuffer out = {buf,(size_t)len,0};
+  while (out.pos<out.size)
+  {
+	if (in.pos==in.size && pending==0)
+	  break; // every frame is finished
+	size_t inpos=in.pos, outpos=out.pos;
+	pending = ZSTD_decompressStream(ds,&out,&in);
+	if (ZSTD_isError(pending))
+	{
+	  err=std::string("The compressed map file is corrupt: ")+ZSTD_getErrorName(pending);
+	  ok=false;
+	  return -1;
+	}
+	if (in.pos==inpos && out.pos==outpos)
+	{ // no progress: all the input is in, but the frame wants more
+	  err="The compressed map file is truncated";
+	  ok=false;
+	  return -1;
+	}
+  }
+  return (int)out.pos;
+}
+#endif
+
+
+TMapStream *OpenMapStream(const char *data,size_t size,std::string &err)
+{
+  TMapStream *s = NULL;
+  switch (MapCompression(data,size))
+  {
+	case mcGzip:
+#ifdef MAP2DBG_ZLIB
+	  s = new TGzipStream(data,size);
+#else
+	  err="This map2dbg was built without gzip support";
+#endif
+	  break;
+	case mcZstd:
+#ifdef MAP2DBG_ZSTD
+	  s = new TZstdStream(data,size);
+#else
+	  err="This map2dbg was built without zstd support";
+#endif
+	  break;
+	default:
+	  err="The map file isn't compressed in a known way";
+	  break;
+  }
+  if (s!=NULL && s->err!="")
+  {
+	err=s->err;
+	delete s;
+	s=NULL;
+  }
+  return s;
+}
+//---------------------------------------------------------------------------
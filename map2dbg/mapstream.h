@@ -0,0 +1,29 @@
+#ifndef mapstreamH
+#define mapstreamH
+
+#include <stddef.h>
+#include <string>
+
+// TMapCompression -- how a map file is stored, going by its first bytes
+enum TMapCompression {mcNone, mcGzip, mcZstd};
+TMapCompression MapCompression(const char *data,size_t size);
+
+// TMapStream -- decompresses a compressed map a buffer at a time, so that
+// the whole decompressed map never has to exist at once. 'data' is the
+// compressed file, usually mapped; it must outlive the stream.
+// Read fills up to 'len' bytes of 'buf', and returns how many it filled:
+// 0 at the end of the data, -1 on an error, with 'err' saying what.
+class TMapStream
+{ public:
+  virtual ~TMapStream() {}
+  virtual int Read(char *buf,int len)=0;
+  std::string err;
+};
+
+// OpenMapStream -- a stream for 'data', which should be gzip or zstd. Returns
+// NULL, with 'err' saying why, if it's neither, or if this build of map2dbg
+// can't decompress it. Gzip needs MAP2DBG_ZLIB defined, and zlib; zstd needs
+// MAP2DBG_ZSTD, and libzstd.
+TMapStream *OpenMapStream(const char *data,size_t size,std::string &err);
+
+#endif
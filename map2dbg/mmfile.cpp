@@ -0,0 +1,174 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#endif
+#pragma hdrstop
+#include "mmfile.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// mmfile -- maps whole files into memory. It's the only place map2dbg needs
+// to know how the platform does this: the map reader and the PE reader both
+// work on the mapped bytes.
+//============================================================================
+
+#ifdef _WIN32
+
+std::string SysErrorText()
+{ LPVOID lpMsgBuf=NULL;
+  FormatMessage(FORMAT_MESSAGE_ALLOCATE_BUFFER | FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS,NULL,GetLastError(),MAKELANGID(LANG_NEUTRAL, SUBLANG_DEFAULT),(LPTSTR) &lpMsgBuf,0,NULL);
+  std::string s = (lpMsgBuf==NULL) ? "" : (char*)lpMsgBuf;
+  LocalFree( lpMsgBuf );
+  while (s.length()>0 && (s[s.length()-1]=='\r' || s[s.length()-1]=='\n')) s.erase(s.length()-1);
+  return s;
+}
+
+TMappedFile::TMappedFile() : base(NULL), size(0), writable(false), hfile(INVALID_HANDLE_VALUE), hmapping(NULL)
+{
+}
+
+bool TMappedFile::Open(const char *fn,bool awritable)
+{
+  Close();
+  writable=awritable;
+  DWORD access = writable ? GENERIC_READ|GENERIC_WRITE : GENERIC_READ;
+  DWORD share  = writable ? 0 : FILE_SHARE_READ;
+  hfile = CreateFile(fn,access,share,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+  if (hfile==INVALID_HANDLE_VALUE)
+  {
+	err="Couldn't open file '"+std::string(fn)+"' - "+SysErrorText();
+	return false;
+  }
+  DWORD sizehi=0;
+  DWORD sizelo = GetFileSize(hfile,&sizehi);
+  if (sizehi!=0 && sizeof(size_t)<=sizeof(DWORD))
+  {
+	err="File '"+std::string(fn)+"' is too big to be mapped into memory.";
+	Close();
+	return false;
+  }
+  size = (size_t)(((unsigned __int64)sizehi<<32) | sizelo);
+  if (size==0)
+	return true;
+  hmapping = CreateFileMapping(hfile,NULL,writable?PAGE_READWRITE:PAGE_READONLY,0,0,NULL);
+  if (hmapping!=NULL)
+	base = (char*)MapViewOfFile(hmapping,writable?FILE_MAP_WRITE:FILE_MAP_READ,0,0,0);
+  if (base==NULL)
+  {
+	err="Couldn't map file '"+std::string(fn)+"' - "+SysErrorText();
+	Close();
+	return false;
+  }
+  return true;
+}
+
+bool TMappedFile::Flush()
+{
+  if (base==NULL || !writable)
+	return true;
+  if (!FlushViewOfFile(base,0))
+  {
+	err="Couldn't write back the mapped file - "+SysErrorText();
+	return false;
+  }
+  return true;
+}
+
+void TMappedFile::Close()
+{
+  if (base!=NULL)
+	UnmapViewOfFile(base);
+  base=NULL;
+  size=0;
+  if (hmapping!=NULL)
+	CloseHandle(hmapping);
+  hmapping=NULL;
+  if (hfile!=INVALID_HANDLE_VALUE)
+	CloseHandle(hfile);
+  hfile=INVALID_HANDLE_VALUE;
+}
+
+#else
+
+std::string SysErrorText()
+{
+  return strerror(errno);
+}
+
+TMappedFile::TMappedFile() : base(NULL), size(0), writable(false), fd(-1)
+{
+}
+
+bool TMappedFile::Open(const char *fn,bool awritable)
+{
+  Close();
+  writable=awritable;
+  fd = open(fn,writable?O_RDWR:O_RDONLY);
+  if (fd<0)
+  {
+	err="Couldn't open file '"+std::string(fn)+"' - "+SysErrorText();
+	return false;
+  }
+  struct stat st;
+  if (fstat(fd,&st)!=0)
+  {
+	err="Couldn't open file '"+std::string(fn)+"' - "+SysErrorText();
+	Close();
+	return false;
+  }
+  if ((unsigned long long)st.st_size > (size_t)-1)
+  {
+	err="File '"+std::string(fn)+"' is too big to be mapped into memory.";
+	Close();
+	return false;
+  }
+  size = (size_t)st.st_size;
+  if (size==0)
+	return true;
+  void *p = mmap(NULL,size,writable?PROT_READ|PROT_WRITE:PROT_READ,MAP_SHARED,fd,0);
+  if (p==MAP_FAILED)
+  {
+	err="Couldn't map file '"+std::string(fn)+"' - "+SysErrorText();
+	size=0;
+	Close();
+	return false;
+  }
+  base=(char*)p;
+  if (!writable)
+	madvise(base,size,MADV_SEQUENTIAL);
+  return true;
+}
+
+bool TMappedFile::Flush()
+{
+  if (base==NULL || !writable)
+	return true;
+  if (msync(base,size,MS_SYNC)!=0)
+  {
+	err="Couldn't write back the mapped file - "+SysErrorText();
+	return false;
+  }
+  return true;
+}
+
+void TMappedFile::Close()
+{
+  if (base!=NULL)
+	munmap(base,size);
+  base=NULL;
+  size=0;
+  if (fd>=0)
+	close(fd);
+  fd=-1;
+}
+
+#endif
+//---------------------------------------------------------------------------
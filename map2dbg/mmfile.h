@@ -0,0 +1,39 @@
+#ifndef mmfileH
+#define mmfileH
+
+#include <stddef.h>
+#include <string>
+
+// TMappedFile -- a whole file mapped into memory, read-only or read-write.
+// It uses CreateFileMapping/MapViewOfFile on Windows and mmap elsewhere.
+// A zero-length file opens fine, with base==NULL and size==0, since it can't
+// be mapped (and has nothing in it anyway). Writes through a writable
+// mapping go straight to the file; Flush pushes them out before Close.
+class TMappedFile
+{ public:
+  TMappedFile();
+  ~TMappedFile() {Close();}
+  bool Open(const char *fn,bool writable=false);
+  bool Flush();
+  void Close();
+  //
+  char *base;      // the mapped view of the whole file
+  size_t size;     // its length
+  std::string err; // why Open or Flush failed, including the system's reason
+protected:
+  bool writable;
+#ifdef _WIN32
+  void *hfile, *hmapping;
+#else
+  int fd;
+#endif
+private:
+  TMappedFile(const TMappedFile&);
+  TMappedFile& operator=(const TMappedFile&);
+};
+
+// SysErrorText -- the system's description of the last error that occurred
+// on this thread (GetLastError, or errno).
+std::string SysErrorText();
+
+#endif
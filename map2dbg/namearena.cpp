@@ -0,0 +1,75 @@
+#include <string.h>
+#pragma hdrstop
+#include "namearena.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// TNameArena -- names stored once, in one growing buffer. The converter
+// hands names around as (offset,length) handles into it, rather than as
+// strings of their own, so that a name costs no allocation beyond its bytes.
+// Interning uses an open-addressed hash table (FNV-1a, linear probing) that
+// is kept at most half full.
+//============================================================================
+
+static const unsigned int FreeSlot = ~0u;
+
+static unsigned int HashName(const char *s,int len)
+{
+  unsigned int h = 2166136261u;
+  for (int i=0; i<len; i++)
+	h = (h ^ (unsigned char)s[i]) * 16777619u;
+  return h;
+}
+
+TNameArena::TNameArena() : ninterned(0)
+{
+  TNameRef none = {0,FreeSlot};
+  slots.assign(64,none);
+}
+
+TNameRef TNameArena::Add(const char *s,int len)
+{
+  TNameRef r;
+  r.off = (unsigned int)buf.size();
+  r.len = (unsigned int)len;
+  buf.insert(buf.end(),s,s+len);
+  return r;
+}
+
+size_t TNameArena::Slot(const char *s,int len) const
+{
+  size_t mask = slots.size()-1;
+  size_t i = HashName(s,len) & mask;
+  while (slots[i].len!=FreeSlot)
+  {
+	if (slots[i].len==(unsigned int)len && memcmp(Ptr(slots[i]),s,len)==0)
+	  return i;
+	i = (i+1) & mask;
+  }
+  return i;
+}
+
+void TNameArena::Grow()
+{
+  std::vector<TNameRef> old;
+  old.swap(slots);
+  TNameRef none = {0,FreeSlot};
+  slots.assign(old.size()*2,none);
+  for (size_t i=0; i<old.size(); i++)
+	if (old[i].len!=FreeSlot)
+	  slots[Slot(Ptr(old[i]),old[i].len)] = old[i];
+}
+
+TNameRef TNameArena::Intern(const char *s,int len)
+{
+  size_t i = Slot(s,len);
+  if (slots[i].len!=FreeSlot)
+	return slots[i];
+  TNameRef r = Add(s,len);
+  slots[i] = r;
+  if (++ninterned*2 > slots.size())
+	Grow();
+  return r;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,36 @@
+#ifndef namearenaH
+#define namearenaH
+
+#include <vector>
+#include <string>
+
+// TNameRef -- a name, as its offset and length in whichever buffer holds it:
+// a TNameArena, or the mapped map file. Handles stay valid as the buffer
+// grows, which pointers into a std::vector wouldn't.
+struct TNameRef
+{ unsigned int off;
+  unsigned int len;
+};
+
+// TNameArena -- a bump-allocated buffer of names. Add copies a name in;
+// Intern does the same, unless an identical name was interned before, in
+// which case it returns that one's handle instead. So equal interned names
+// have equal handles, and can be compared and looked up by offset alone.
+// Names aren't nul-terminated.
+class TNameArena
+{ public:
+  TNameArena();
+  TNameRef Add(const char *s,int len);
+  TNameRef Intern(const char *s,int len);
+  const char *Ptr(TNameRef r) const {return buf.empty() ? "" : &buf[r.off];}
+  std::string Str(TNameRef r) const {return std::string(Ptr(r),r.len);}
+  size_t Size() const {return buf.size();}
+protected:
+  std::vector<char> buf;
+  std::vector<TNameRef> slots; // open-addressed table of the interned names; len==~0 if free
+  size_t ninterned;
+  size_t Slot(const char *s,int len) const; // where s is, or where it would go
+  void Grow();
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#pragma hdrstop
+#include "peimage.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// TPEImage -- reads the headers of a PE/COFF file in place. The layout is
+//   @0.         IMAGE_DOS_HEADER, whose e_lfanew gives the offset of...
+//   @e_lfanew.  'PE\0\0' signature
+//   @.          IMAGE_FILE_HEADER
+//   @.          optional header, of size FileHeader.SizeOfOptionalHeader:
+//               IMAGE_OPTIONAL_HEADER32 or 64, according to its Magic
+//   @.          NumberOfSections * IMAGE_SECTION_HEADER
+// Every offset is checked against the size of the file before it's used, so
+// a truncated or foreign file gives an error rather than a crash.
+//============================================================================
+
+bool TPEImage::Open(const char *fn,bool writable)
+{
+  Close();
+  err="";
+  if (!file.Open(fn,writable))
+  {
+	err=file.err;
+	return false;
+  }
+  const std::string what = "'"+std::string(fn)+"'";
+  char *base=file.base; size_t size=file.size;
+  //
+  IMAGE_DOS_HEADER *dos = (IMAGE_DOS_HEADER*)base;
+  if (size<sizeof(IMAGE_DOS_HEADER) || dos->e_magic!=IMAGE_DOS_SIGNATURE)
+  {
+	err=what+" is not an executable (no MZ header).";
+	Close();
+	return false;
+  }
+  size_t ofh = (size_t)(DWORD)dos->e_lfanew + sizeof(DWORD);
+  if (dos->e_lfanew<=0 || ofh+sizeof(IMAGE_FILE_HEADER)>size || *(DWORD*)(base+dos->e_lfanew)!=IMAGE_NT_SIGNATURE)
+  {
+	err=what+" is not a PE executable (no PE header).";
+	Close();
+	return false;
+  }
+  FileHeader = (IMAGE_FILE_HEADER*)(base+ofh);
+  //
+  size_t oopt = ofh+sizeof(IMAGE_FILE_HEADER);
+  size_t szopt = FileHeader->SizeOfOptionalHeader;
+  WORD magic = (szopt>=sizeof(WORD) && oopt+sizeof(WORD)<=size) ? *(WORD*)(base+oopt) : 0;
+  if (magic==IMAGE_NT_OPTIONAL_HDR32_MAGIC && szopt>=offsetof(IMAGE_OPTIONAL_HEADER32,DataDirectory))
+	opt32 = (IMAGE_OPTIONAL_HEADER32*)(base+oopt);
+  else if (magic==IMAGE_NT_OPTIONAL_HDR64_MAGIC && szopt>=offsetof(IMAGE_OPTIONAL_HEADER64,DataDirectory))
+	opt64 = (IMAGE_OPTIONAL_HEADER64*)(base+oopt);
+  if ((opt32==NULL && opt64==NULL) || oopt+szopt>size)
+  {
+	err=what+" has no usable optional header.";
+	Close();
+	return false;
+  }
+  is64 = (opt64!=NULL);
+  //
+  size_t osec = oopt+szopt;
+  NumberOfSections = FileHeader->NumberOfSections;
+  if (osec+NumberOfSections*sizeof(IMAGE_SECTION_HEADER)>size)
+  {
+	err=what+" is truncated: its section table runs past the end of the file.";
+	Close();
+	return false;
+  }
+  Sections = (IMAGE_SECTION_HEADER*)(base+osec);
+  return true;
+}
+
+bool TPEImage::Flush()
+{
+  if (!file.Flush())
+  {
+	err=file.err;
+	return false;
+  }
+  return true;
+}
+
+void TPEImage::Close()
+{
+  file.Close();
+  FileHeader=NULL;
+  Sections=NULL;
+  NumberOfSections=0;
+  is64=false;
+  opt32=NULL;
+  opt64=NULL;
+}
+//---------------------------------------------------------------------------
@@ -0,0 +1,211 @@
+#ifndef peimageH
+#define peimageH
+
+#include <string>
+#include "mmfile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+// The parts of winnt.h that map2dbg uses, for platforms that don't have it.
+// They describe the on-disk PE/COFF and .dbg formats, so the field widths
+// are fixed whatever the compiler's 'long' is.
+typedef unsigned char      BYTE;
+typedef unsigned short     WORD;
+typedef unsigned int       DWORD;
+typedef int                LONG;
+typedef unsigned long long ULONGLONG;
+
+#define IMAGE_DOS_SIGNATURE             0x5A4D     // MZ
+#define IMAGE_NT_SIGNATURE              0x00004550 // PE00
+#define IMAGE_NT_OPTIONAL_HDR32_MAGIC   0x10b
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC   0x20b
+#define IMAGE_NUMBEROF_DIRECTORY_ENTRIES 16
+#define IMAGE_SIZEOF_SHORT_NAME         8
+#define IMAGE_FILE_DEBUG_STRIPPED       0x0200
+#define IMAGE_SEPARATE_DEBUG_SIGNATURE  0x4944     // DI
+#define IMAGE_DEBUG_TYPE_CODEVIEW       2
+
+typedef struct _IMAGE_DOS_HEADER {
+    WORD   e_magic;
+    WORD   e_cblp;
+    WORD   e_cp;
+    WORD   e_crlc;
+    WORD   e_cparhdr;
+    WORD   e_minalloc;
+    WORD   e_maxalloc;
+    WORD   e_ss;
+    WORD   e_sp;
+    WORD   e_csum;
+    WORD   e_ip;
+    WORD   e_cs;
+    WORD   e_lfarlc;
+    WORD   e_ovno;
+    WORD   e_res[4];
+    WORD   e_oemid;
+    WORD   e_oeminfo;
+    WORD   e_res2[10];
+    LONG   e_lfanew;
+} IMAGE_DOS_HEADER;
+
+typedef struct _IMAGE_FILE_HEADER {
+    WORD    Machine;
+    WORD    NumberOfSections;
+    DWORD   TimeDateStamp;
+    DWORD   PointerToSymbolTable;
+    DWORD   NumberOfSymbols;
+    WORD    SizeOfOptionalHeader;
+    WORD    Characteristics;
+} IMAGE_FILE_HEADER;
+
+typedef struct _IMAGE_DATA_DIRECTORY {
+    DWORD   VirtualAddress;
+    DWORD   Size;
+} IMAGE_DATA_DIRECTORY;
+
+typedef struct _IMAGE_OPTIONAL_HEADER {
+    WORD    Magic;
+    BYTE    MajorLinkerVersion;
+    BYTE    MinorLinkerVersion;
+    DWORD   SizeOfCode;
+    DWORD   SizeOfInitializedData;
+    DWORD   SizeOfUninitializedData;
+    DWORD   AddressOfEntryPoint;
+    DWORD   BaseOfCode;
+    DWORD   BaseOfData;
+    DWORD   ImageBase;
+    DWORD   SectionAlignment;
+    DWORD   FileAlignment;
+    WORD    MajorOperatingSystemVersion;
+    WORD    MinorOperatingSystemVersion;
+    WORD    MajorImageVersion;
+    WORD    MinorImageVersion;
+    WORD    MajorSubsystemVersion;
+    WORD    MinorSubsystemVersion;
+    DWORD   Win32VersionValue;
+    DWORD   SizeOfImage;
+    DWORD   SizeOfHeaders;
+    DWORD   CheckSum;
+    WORD    Subsystem;
+    WORD    DllCharacteristics;
+    DWORD   SizeOfStackReserve;
+    DWORD   SizeOfStackCommit;
+    DWORD   SizeOfHeapReserve;
+    DWORD   SizeOfHeapCommit;
+    DWORD   LoaderFlags;
+    DWORD   NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER32;
+
+#pragma pack(push,4)
+typedef struct _IMAGE_OPTIONAL_HEADER64 {
+    WORD        Magic;
+    BYTE        MajorLinkerVersion;
+    BYTE        MinorLinkerVersion;
+    DWORD       SizeOfCode;
+    DWORD       SizeOfInitializedData;
+    DWORD       SizeOfUninitializedData;
+    DWORD       AddressOfEntryPoint;
+    DWORD       BaseOfCode;
+    ULONGLONG   ImageBase;
+    DWORD       SectionAlignment;
+    DWORD       FileAlignment;
+    WORD        MajorOperatingSystemVersion;
+    WORD        MinorOperatingSystemVersion;
+    WORD        MajorImageVersion;
+    WORD        MinorImageVersion;
+    WORD        MajorSubsystemVersion;
+    WORD        MinorSubsystemVersion;
+    DWORD       Win32VersionValue;
+    DWORD       SizeOfImage;
+    DWORD       SizeOfHeaders;
+    DWORD       CheckSum;
+    WORD        Subsystem;
+    WORD        DllCharacteristics;
+    ULONGLONG   SizeOfStackReserve;
+    ULONGLONG   SizeOfStackCommit;
+    ULONGLONG   SizeOfHeapReserve;
+    ULONGLONG   SizeOfHeapCommit;
+    DWORD       LoaderFlags;
+    DWORD       NumberOfRvaAndSizes;
+    IMAGE_DATA_DIRECTORY DataDirectory[IMAGE_NUMBEROF_DIRECTORY_ENTRIES];
+} IMAGE_OPTIONAL_HEADER64;
+#pragma pack(pop)
+
+typedef struct _IMAGE_SECTION_HEADER {
+    BYTE    Name[IMAGE_SIZEOF_SHORT_NAME];
+    union {
+            DWORD   PhysicalAddress;
+            DWORD   VirtualSize;
+    } Misc;
+    DWORD   VirtualAddress;
+    DWORD   SizeOfRawData;
+    DWORD   PointerToRawData;
+    DWORD   PointerToRelocations;
+    DWORD   PointerToLinenumbers;
+    WORD    NumberOfRelocations;
+    WORD    NumberOfLinenumbers;
+    DWORD   Characteristics;
+} IMAGE_SECTION_HEADER;
+
+typedef struct _IMAGE_SEPARATE_DEBUG_HEADER {
+    WORD        Signature;
+    WORD        Flags;
+    WORD        Machine;
+    WORD        Characteristics;
+    DWORD       TimeDateStamp;
+    DWORD       CheckSum;
+    DWORD       ImageBase;
+    DWORD       SizeOfImage;
+    DWORD       NumberOfSections;
+    DWORD       ExportedNamesSize;
+    DWORD       DebugDirectorySize;
+    DWORD       SectionAlignment;
+    DWORD       Reserved[2];
+} IMAGE_SEPARATE_DEBUG_HEADER;
+
+typedef struct _IMAGE_DEBUG_DIRECTORY {
+    DWORD   Characteristics;
+    DWORD   TimeDateStamp;
+    WORD    MajorVersion;
+    WORD    MinorVersion;
+    DWORD   Type;
+    DWORD   SizeOfData;
+    DWORD   AddressOfRawData;
+    DWORD   PointerToRawData;
+} IMAGE_DEBUG_DIRECTORY;
+#endif
+
+
+// TPEImage -- the headers of a PE/COFF executable (exe, dll, bpl), read
+// straight out of a mapping of the file. It replaces imagehlp's MapAndLoad,
+// which only exists on Windows and also maps in the whole image the way the
+// loader would; we only ever want the headers.
+// FileHeader and Sections point into the mapping, so they're only valid
+// until Close. When the image is opened writable, changes made through them
+// go straight into the file. Both PE32 and PE32+ images are accepted; the
+// optional-header fields that differ between the two are read through the
+// accessors.
+class TPEImage
+{ public:
+  TPEImage() : FileHeader(NULL), Sections(NULL), NumberOfSections(0), is64(false), opt32(NULL), opt64(NULL) {}
+  bool Open(const char *fn,bool writable=false);
+  bool Flush(); // after changes, when writable
+  void Close();
+  //
+  IMAGE_FILE_HEADER    *FileHeader;
+  IMAGE_SECTION_HEADER *Sections;
+  int                   NumberOfSections;
+  bool                  is64;       // PE32+
+  ULONGLONG ImageBase() const        {return is64 ? opt64->ImageBase : opt32->ImageBase;}
+  DWORD     CheckSum() const         {return is64 ? opt64->CheckSum : opt32->CheckSum;}
+  DWORD     SizeOfImage() const      {return is64 ? opt64->SizeOfImage : opt32->SizeOfImage;}
+  DWORD     SectionAlignment() const {return is64 ? opt64->SectionAlignment : opt32->SectionAlignment;}
+  std::string err;
+protected:
+  TMappedFile file;
+  IMAGE_OPTIONAL_HEADER32 *opt32;
+  IMAGE_OPTIONAL_HEADER64 *opt64;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef vclshimH
+#define vclshimH
+
+//============================================================================
+// vclshim -- the few VCL things map2dbg's converter uses: AnsiString and a
+// handful of file-name and number helpers. Under C++Builder it just pulls in
+// the VCL. Anywhere else it supplies look-alikes built on std::string, so
+// that the command-line converter also builds with e.g. gcc on Linux:
+//   g++ -O2 map2dbgcmd.cpp convert.cpp mapline.cpp workers.cpp mmfile.cpp peimage.cpp batch.cpp namearena.cpp dbgcache.cpp mapstream.cpp -lpthread -o map2dbg
+// adding -DMAP2DBG_ZLIB ... -lz and -DMAP2DBG_ZSTD ... -lzstd for compressed maps.
+// Only what map2dbg actually calls is here. As in the VCL, AnsiString
+// indexes from 1.
+//============================================================================
+
+#ifdef __BORLANDC__
+#include <system.hpp>
+#include <sysutils.hpp>
+#else
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <string>
+
+class AnsiString
+{ public:
+  AnsiString() {}
+  AnsiString(const char *p) : s(p==NULL?"":p) {}
+  AnsiString(const char *p,int len) : s(p,len) {}
+  AnsiString(const std::string &a) : s(a) {}
+  AnsiString(int i) {char buf[16]; sprintf(buf,"%d",i); s=buf;}
+  const char *c_str() const {return s.c_str();}
+  int Length() const {return (int)s.length();}
+  bool IsEmpty() const {return s.empty();}
+  char &operator[](int i) {return s[i-1];}
+  char operator[](int i) const {return s[i-1];}
+  AnsiString SubString(int index,int count) const
+  { if (index<1) index=1;
+	if (index>Length() || count<=0) return AnsiString();
+	return AnsiString(s.substr(index-1,count));
+  }
+  int Pos(const AnsiString &sub) const
+  { std::string::size_type i=s.find(sub.s);
+	return (i==std::string::npos) ? 0 : (int)i+1;
+  }
+  AnsiString operator+(const AnsiString &a) const {return AnsiString(s+a.s);}
+  AnsiString &operator+=(const AnsiString &a) {s+=a.s; return *this;}
+  bool operator==(const AnsiString &a) const {return s==a.s;}
+  bool operator!=(const AnsiString &a) const {return s!=a.s;}
+  bool operator<(const AnsiString &a) const {return s<a.s;}
+protected:
+  std::string s;
+};
+inline AnsiString operator+(const char *a,const AnsiString &b) {return AnsiString(a)+b;}
+typedef AnsiString String;
+
+// Path helpers. Both '/' and '\' count as separators, and ':' as the end of
+// a drive, so Windows paths given on other platforms still split sensibly.
+inline int LastDelimiterPos(const AnsiString &fn,const char *delims)
+{ for (int i=fn.Length(); i>=1; i--)
+	for (const char *d=delims; *d!=0; d++)
+	  if (fn[i]==*d) return i;
+  return 0;
+}
+inline AnsiString ExtractFileName(const AnsiString &fn)
+{ int i=LastDelimiterPos(fn,"/\\:");
+  return fn.SubString(i+1,fn.Length()-i);
+}
+inline AnsiString ExtractFilePath(const AnsiString &fn)
+{ return fn.SubString(1,LastDelimiterPos(fn,"/\\:"));
+}
+inline AnsiString ExtractFileExt(const AnsiString &fn)
+{ int i=LastDelimiterPos(fn,"./\\:");
+  if (i==0 || fn[i]!='.') return AnsiString();
+  return fn.SubString(i,fn.Length()-i+1);
+}
+inline AnsiString ChangeFileExt(const AnsiString &fn,const AnsiString &ext)
+{ int i=LastDelimiterPos(fn,"./\\:");
+  if (i==0 || fn[i]!='.') i=fn.Length()+1;
+  return fn.SubString(1,i-1)+ext;
+}
+inline AnsiString ExpandFileName(const AnsiString &fn) // the full path, or fn if there isn't one
+{
+#ifdef _WIN32
+  char buf[_MAX_PATH];
+  return _fullpath(buf,fn.c_str(),sizeof(buf))!=NULL ? AnsiString(buf) : fn;
+#else
+  AnsiString dir=ExtractFilePath(fn);
+  char buf[PATH_MAX];
+  if (realpath(dir.IsEmpty() ? "." : dir.c_str(),buf)==NULL) return fn;
+  return AnsiString(buf)+"/"+ExtractFileName(fn);
+#endif
+}
+inline bool SameFileName(const AnsiString &a,const AnsiString &b)
+{
+#ifdef _WIN32
+  return _stricmp(a.c_str(),b.c_str())==0; // Windows file names ignore case
+#else
+  return a==b;
+#endif
+}
+inline bool FileExists(const AnsiString &fn)
+{ struct stat st;
+  return stat(fn.c_str(),&st)==0 && S_ISREG(st.st_mode);
+}
+inline AnsiString IntToStr(int i) {return AnsiString(i);}
+inline int StrToIntDef(const AnsiString &a,int def)
+{ const char *p=a.c_str(); char *e=NULL;
+  long v=strtol(p,&e,10);
+  return (a.IsEmpty() || e==NULL || *e!=0) ? def : (int)v;
+}
+#endif
+
+#endif
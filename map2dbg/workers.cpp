@@ -0,0 +1,132 @@
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#endif
+#include <stdlib.h>
+#pragma hdrstop
+#include "workers.h"
+//---------------------------------------------------------------------------
+#pragma package(smart_init)
+
+//============================================================================
+// workers -- a minimal fork/join helper on top of CreateThread (or pthreads,
+// away from Windows), for the few places where map2dbg can spread work over
+// several cores.
+//============================================================================
+
+#ifdef _WIN32
+int NumberOfCores()
+{
+  SYSTEM_INFO si;
+  GetSystemInfo(&si);
+  return (si.dwNumberOfProcessors>0) ? (int)si.dwNumberOfProcessors : 1;
+}
+
+struct TWorkerStart {TWorkerProc proc; void *arg;};
+
+static DWORD WINAPI WorkerThread(LPVOID p)
+{
+  TWorkerStart *ws = (TWorkerStart*)p;
+  ws->proc(ws->arg);
+  return 0;
+}
+
+void RunWorkers(int n,TWorkerProc proc,void **args)
+{
+  if (n<=0)
+	return;
+  TWorkerStart *ws = new TWorkerStart[n];
+  HANDLE *hthreads = new HANDLE[n];
+  for (int i=1; i<n; i++)
+  {
+	ws[i].proc=proc;
+	ws[i].arg=args[i];
+	DWORD tid;
+	hthreads[i] = CreateThread(NULL,0,WorkerThread,&ws[i],0,&tid);
+  }
+  proc(args[0]);
+  for (int i=1; i<n; i++)
+  {
+	if (hthreads[i]==NULL)
+	  proc(args[i]);
+	else
+	{
+	  WaitForSingleObject(hthreads[i],INFINITE);
+	  CloseHandle(hthreads[i]);
+	}
+  }
+  delete[] hthreads;
+  delete[] ws;
+}
+
+long AtomicIncrement(volatile long *v)
+{
+  return InterlockedIncrement(v);
+}
+
+double WallClock()
+{
+  LARGE_INTEGER freq, now;
+  if (!QueryPerformanceFrequency(&freq) || !QueryPerformanceCounter(&now))
+	return GetTickCount()/1000.0;
+  return (double)now.QuadPart/(double)freq.QuadPart;
+}
+
+#else
+int NumberOfCores()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n>0) ? (int)n : 1;
+}
+
+struct TWorkerStart {TWorkerProc proc; void *arg;};
+
+static void *WorkerThread(void *p)
+{
+  TWorkerStart *ws = (TWorkerStart*)p;
+  ws->proc(ws->arg);
+  return NULL;
+}
+
+void RunWorkers(int n,TWorkerProc proc,void **args)
+{
+  if (n<=0)
+	return;
+  TWorkerStart *ws = new TWorkerStart[n];
+  pthread_t *hthreads = new pthread_t[n];
+  bool *started = new bool[n];
+  for (int i=1; i<n; i++)
+  {
+	ws[i].proc=proc;
+	ws[i].arg=args[i];
+	started[i] = (pthread_create(&hthreads[i],NULL,WorkerThread,&ws[i])==0);
+  }
+  proc(args[0]);
+  for (int i=1; i<n; i++)
+  {
+	if (!started[i])
+	  proc(args[i]);
+	else
+	  pthread_join(hthreads[i],NULL);
+  }
+  delete[] started;
+  delete[] hthreads;
+  delete[] ws;
+}
+
+long AtomicIncrement(volatile long *v)
+{
+  return __sync_add_and_fetch(v,1);
+}
+
+double WallClock()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+#endif
+//---------------------------------------------------------------------------
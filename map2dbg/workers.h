@@ -0,0 +1,26 @@
+#ifndef workersH
+#define workersH
+
+// TWorkerProc -- the body of a worker thread; 'arg' is the worker's own slot.
+typedef void (*TWorkerProc)(void *arg);
+
+// NumberOfCores -- how many processors the machine has (at least 1).
+int NumberOfCores();
+
+// RunWorkers -- runs proc(args[i]) for each i<n on its own thread, and
+// returns once all of them have finished. Worker 0 runs on the calling
+// thread. If a thread can't be created, that worker runs on the calling
+// thread instead, so every proc is always run exactly once.
+void RunWorkers(int n,TWorkerProc proc,void **args);
+
+// AtomicIncrement -- adds one to *v, safely against other threads doing the
+// same, and returns the new value. Workers use it to take turns at a shared
+// queue of jobs.
+long AtomicIncrement(volatile long *v);
+
+// WallClock -- a monotonic wall-clock time in seconds, for timing phases of
+// work that may be spread over several threads. Only differences between
+// two readings mean anything.
+double WallClock();
+
+#endif